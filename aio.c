@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include "aio.h"
+#include "disk.h"
+
+// Worker loop: take requests off the queue and read them in
+static void *aio_worker(void *arg)
+{
+	AIO *aio = arg;
+	pthread_mutex_lock(&aio->lock);
+	for (;;)
+	{
+		while (!aio->queue_head && !aio->stop) pthread_cond_wait(&aio->submitted, &aio->lock);
+		if (!aio->queue_head) break;
+		
+		AIO_Request *req = aio->queue_head;
+		aio->queue_head = req->next;
+		if (!aio->queue_head) aio->queue_tail = NULL;
+		
+		// Read without holding the lock so the other workers keep going
+		pthread_mutex_unlock(&aio->lock);
+		disk_read_block(aio->disk, req->block_number, req->buf);
+		pthread_mutex_lock(&aio->lock);
+		
+		req->next = aio->done;
+		aio->done = req;
+		pthread_cond_signal(&aio->completed);
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return NULL;
+}
+
+AIO *aio_create(struct DiskInterface *disk, int workers)
+{
+	AIO *aio = malloc(sizeof(AIO));
+	aio->disk = disk;
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->submitted, NULL);
+	pthread_cond_init(&aio->completed, NULL);
+	aio->queue_head = NULL;
+	aio->queue_tail = NULL;
+	aio->done = NULL;
+	aio->in_flight = 0;
+	aio->stop = false;
+	
+	if (workers < 1) workers = 1;
+	if (workers > AIO_MAX_WORKERS) workers = AIO_MAX_WORKERS;
+	aio->worker_count = 0;
+	for (int i=0; i<workers; i++)
+	{
+		if (pthread_create(&aio->workers[i], NULL, aio_worker, aio)==0) aio->worker_count++;
+	}
+	if (aio->worker_count==0)
+	{
+		aio_destroy(aio);
+		return NULL;
+	}
+	return aio;
+}
+
+void aio_submit(AIO *aio, AIO_Request *req)
+{
+	req->next = NULL;
+	pthread_mutex_lock(&aio->lock);
+	if (aio->queue_tail) aio->queue_tail->next = req;
+	else aio->queue_head = req;
+	aio->queue_tail = req;
+	aio->in_flight++;
+	pthread_cond_signal(&aio->submitted);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+AIO_Request *aio_reap(AIO *aio, bool wait)
+{
+	pthread_mutex_lock(&aio->lock);
+	while (wait && !aio->done && aio->in_flight) pthread_cond_wait(&aio->completed, &aio->lock);
+	AIO_Request *done = aio->done;
+	aio->done = NULL;
+	for (AIO_Request *req = done; req; req = req->next) aio->in_flight--;
+	pthread_mutex_unlock(&aio->lock);
+	return done;
+}
+
+void aio_destroy(AIO *aio)
+{
+	pthread_mutex_lock(&aio->lock);
+	aio->stop = true;
+	pthread_cond_broadcast(&aio->submitted);
+	pthread_mutex_unlock(&aio->lock);
+	for (int i=0; i<aio->worker_count; i++)
+	{
+		pthread_join(aio->workers[i], NULL);
+	}
+	pthread_cond_destroy(&aio->submitted);
+	pthread_cond_destroy(&aio->completed);
+	pthread_mutex_destroy(&aio->lock);
+	free(aio);
+}
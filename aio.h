@@ -0,0 +1,66 @@
+#ifndef AIO_H
+#define AIO_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "config.h"
+
+/*=== Asynchronous Block Reads ===*/
+
+/**
+ * A small pool of worker threads reads blocks from the disk image into
+ * caller-supplied buffers. Requests are queued by the thread that owns the
+ * cache and handed back to it through a completion list, so workers never
+ * touch cache state.
+ */
+
+struct DiskInterface;
+
+typedef struct AIO_Request
+{
+	uint64_t block_number;       // Block to read
+	void *buf;                   // BLOCK_SIZE buffer the block is read into
+	void *ctx;                   // Owner's bookkeeping for the request
+	struct AIO_Request *next;
+} AIO_Request;
+
+typedef struct AIO
+{
+	struct DiskInterface *disk;
+	pthread_t workers[AIO_MAX_WORKERS];
+	int worker_count;
+	pthread_mutex_t lock;
+	pthread_cond_t submitted;    // Signalled when a request is queued or the pool stops
+	pthread_cond_t completed;    // Signalled when a request finishes
+	AIO_Request *queue_head;     // Requests waiting for a worker (FIFO)
+	AIO_Request *queue_tail;
+	AIO_Request *done;           // Finished requests not yet reaped
+	uint64_t in_flight;          // Requests submitted but not yet reaped
+	bool stop;
+} AIO;
+
+/**
+ * Start a pool of worker threads reading from a disk
+ * @param workers Number of threads, capped at AIO_MAX_WORKERS
+ */
+AIO *aio_create(struct DiskInterface *disk, int workers);
+
+/**
+ * Queue a read of req->block_number into req->buf
+ */
+void aio_submit(AIO *aio, AIO_Request *req);
+
+/**
+ * Take the finished requests
+ * @param wait Block until at least one request finishes if none has yet
+ * @return List of finished requests linked through next, or NULL
+ */
+AIO_Request *aio_reap(AIO *aio, bool wait);
+
+/**
+ * Finish the queued reads and stop the workers
+ * Requests that were not reaped are left to their owner to free
+ */
+void aio_destroy(AIO *aio);
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+// Mix a key with a seed (splitmix64 finalizer)
+static uint64_t bloom_hash(uint64_t key, uint64_t seed)
+{
+	uint64_t x = key + seed;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// One hash picks the bucket, a second one the bits within it
+// The bit positions are derived by double hashing, so every probe of a
+// lookup lands in the same cache line
+static uint64_t *bloom_bucket(Bloom *filter, uint64_t key, uint64_t *h)
+{
+	uint64_t bucket = bloom_hash(key, 0x9e3779b97f4a7c15ULL) % filter->buckets;
+	*h = bloom_hash(key, 0xd6e8feb86659fd93ULL);
+	return &filter->bits[bucket * BLOOM_BUCKET_WORDS];
+}
+
+Bloom *bloom_create_buckets(uint64_t buckets)
+{
+	Bloom *filter = malloc(sizeof(Bloom));
+	filter->buckets = buckets ? buckets : 1;
+	filter->bits = calloc(filter->buckets * BLOOM_BUCKET_WORDS, sizeof(uint64_t));
+	return filter;
+}
+
+// Round the bits wanted for the keys up to whole buckets
+Bloom *bloom_create(uint64_t keys)
+{
+	uint64_t bucket_bits = BLOOM_BUCKET_WORDS * 64;
+	return bloom_create_buckets((keys * BLOOM_BITS_PER_KEY + bucket_bits - 1) / bucket_bits);
+}
+
+uint64_t bloom_add(Bloom *filter, uint64_t key)
+{
+	uint64_t h;
+	uint64_t *bucket = bloom_bucket(filter, key, &h);
+	uint32_t a = h, b = (h >> 32) | 1;
+	
+	for (int i=0; i<BLOOM_HASHES; i++)
+	{
+		uint32_t bit = (a + i * b) % (BLOOM_BUCKET_WORDS * 64);
+		bucket[bit / 64] |= 1ULL << (bit % 64);
+	}
+	return (bucket - filter->bits) / BLOOM_BUCKET_WORDS;
+}
+
+bool bloom_may_contain(Bloom *filter, uint64_t key)
+{
+	uint64_t h;
+	uint64_t *bucket = bloom_bucket(filter, key, &h);
+	uint32_t a = h, b = (h >> 32) | 1;
+	
+	for (int i=0; i<BLOOM_HASHES; i++)
+	{
+		uint32_t bit = (a + i * b) % (BLOOM_BUCKET_WORDS * 64);
+		if (!(bucket[bit / 64] & (1ULL << (bit % 64)))) return false;
+	}
+	return true;
+}
+
+void bloom_clear(Bloom *filter)
+{
+	memset(filter->bits, 0, filter->buckets * BLOOM_BUCKET_WORDS * sizeof(uint64_t));
+}
+
+void bloom_free(Bloom *filter)
+{
+	free(filter->bits);
+	free(filter);
+}
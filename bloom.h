@@ -0,0 +1,50 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*=== Blocked Bloom filter ===*/
+
+#define BLOOM_BITS_PER_KEY 10    // Filter bits per expected key (about 1% false positives)
+#define BLOOM_HASHES 7           // Bits set per key, all within one bucket
+#define BLOOM_BUCKET_WORDS 8     // 64-bit words per bucket (one cache line)
+
+typedef struct Bloom
+{
+	uint64_t buckets;            // Number of buckets
+	uint64_t *bits;              // buckets * BLOOM_BUCKET_WORDS words
+} Bloom;
+
+/**
+ * Create an empty filter sized for the given number of keys
+ * @param keys Number of keys the filter is expected to hold
+ * @return Pointer to newly allocated filter
+ */
+Bloom *bloom_create(uint64_t keys);
+
+/**
+ * Create an empty filter with an exact number of buckets
+ */
+Bloom *bloom_create_buckets(uint64_t buckets);
+
+/**
+ * Add a key to the filter
+ * @return Bucket the key's bits were set in
+ */
+uint64_t bloom_add(Bloom *filter, uint64_t key);
+
+/**
+ * Test whether a key may have been added
+ * Only touches the one bucket the key hashes to
+ * @return false if the key was definitely never added
+ */
+bool bloom_may_contain(Bloom *filter, uint64_t key);
+
+/**
+ * Remove every key from the filter
+ */
+void bloom_clear(Bloom *filter);
+
+void bloom_free(Bloom *filter);
+
+#endif
@@ -1,10 +1,21 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
 #include "btr.h"
 #include "disk.h"
 #include "hash.h"
+#include "bloom.h"
+#include "dcache.h"
+#include "memtable.h"
+
+/**
+ * First byte of a node's block after the node itself
+ * Leaves keep their slotted page there and internal nodes their message buffer
+ */
+#define BTREE_NODE_END ((1 + sizeof(struct BTreeNode) + 7) & ~7UL)
 
 /**
  * Create a new B-tree node on disk
@@ -27,22 +38,60 @@ BTreeNode* btree_node_create(DiskInterface* disk, cache *cache, bool is_leaf)
 	node->key = 0;
 	node->num_keys = 0;
 	node->value = 0;
-	node->parent = 0;
 	node->left_sibling = 0;
 	node->right_sibling = 0;
 	
 	// Initialize all keys and children to 0
-	for(int i=0; i<MAX_KEYS; i++) node->keys[i]=0;
-	for(int i=0; i<=MAX_KEYS; i++) node->children[i]=0;
+	for(int i=0; i<=MAX_KEYS; i++) node->keys[i]=0;
+	for(int i=0; i<=MAX_KEYS+1; i++) node->children[i]=0;
+	for(int i=0; i<=MAX_KEYS+1; i++) node->counts[i]=0;
+	
+	// A reused block may still hold an old message buffer
+	if (!is_leaf) *(uint16_t*)((char*)ptr + BTREE_NODE_END) = 0;
+	
+	// The block was modified in place, so make sure it gets written back.
+	// It may sit in the transient buffer, which the first mark copies into
+	// the cache, so every write has to come before it.
+	cache_mark_dirty(disk, cache, page, 1, sizeof(struct BTreeNode));
+	if (!is_leaf) cache_mark_dirty(disk, cache, page, BTREE_NODE_END, sizeof(uint16_t));
 	
 	return node;
 }
 
+/**
+ * Block of a freed node waiting for readers to leave it
+ */
+typedef struct btree_deferred_free_t
+{
+	DiskInterface* disk;
+	cache *cache;
+	uint64_t block_number;
+} btree_deferred_free_t;
+
+static void btree_node_reclaim(void *ptr, void *ctx)
+{
+	(void)ctx;
+	btree_deferred_free_t *deferred = ptr;
+	free_page(deferred->disk, deferred->cache, deferred->block_number);
+	free(deferred);
+}
+
 /**
  * Free a B-tree node and return its disk block to the free pool
+ * With epoch reclamation enabled the block stays allocated until the epoch
+ * has moved past every critical section that was open when it was freed
  */
 void btree_node_free(DiskInterface* disk, cache *cache, BTreeNode* node)
 {
+	if (cache->ebr)
+	{
+		btree_deferred_free_t *deferred = malloc(sizeof(btree_deferred_free_t));
+		deferred->disk = disk;
+		deferred->cache = cache;
+		deferred->block_number = node->block_number;
+		ebr_retire(cache->ebr, cache->ebr_tid, deferred, btree_node_reclaim, NULL);
+		return;
+	}
 	free_page(disk, cache, node->block_number);
 }
 
@@ -69,651 +118,2769 @@ int btree_node_read(DiskInterface* disk, cache *cache, uint64_t block_num, BTree
  */
 int btree_node_write(DiskInterface* disk, cache *cache, BTreeNode* node)
 {
-	int rv;
-	BTreeNode *mem_node = (BTreeNode*)( (block_type_t*) (get_block(disk, cache, 0, node->block_number) + 1) );;
-	
-	// Copy node data from memory to disk
-	void *ptr = memcpy((char*)mem_node, (char*)node, sizeof(struct BTreeNode));
+	// Copy node data from memory into its cached block, dirtying only the node bytes
+	write_block_range(disk, cache, node, 0, node->block_number, 1, sizeof(struct BTreeNode));
 	
-	rv = (ptr==NULL) ? -1 : 0;
-	
-	return rv;
+	return 0;
 }
 
 /**
- * Search for a key in the B-tree
- * Recursively traverses the tree to find the specified key
+ * Pick the child of an internal node whose subtree covers a key
+ * keys[i] separates children[i] (keys <= keys[i]) from children[i+1]
  */
-uint64_t btree_search(DiskInterface* disk, cache *cache, uint64_t node_block, uint64_t key)
+static int btree_child_index(BTreeNode *node, uint64_t key)
 {
-	BTreeNode node;
-	btree_node_read(disk, cache, node_block, &node);
-	
-	if (node.is_leaf) {
-		// Base case: we're at a leaf node
-		if (node.key == key) {
-			printf("Found key!\n");
-			return node.block_number;
-		} else {
-			return -1;  // Key not found
-		}
-	} else {
-		// Recursive case: search all children
-		for (int i = 0; i <= node.num_keys; i++) {
-			if (node.children[i] != 0) {
-				uint64_t result = btree_search(disk, cache, node.children[i], key);
-				if (result != -1) {
-					return result;  // Found in child subtree
-				}
-			}
-		}
-		printf("Did not find key!\n");
-		return -1;  // Key not found in any subtree
-	}
+	int i;
+	for (i = 0; i < node->num_keys && key > node->keys[i]; i++);
+	return i;
 }
 
 /**
- * Find the depth of a node in the B-tree
- * Follows the leftmost path down to a leaf to determine depth
+ * Message waiting in an internal node's buffer to be applied below it
+ * Buffers hold messages in arrival order, and a node's buffer is always
+ * newer than the buffers of the nodes under it.
  */
-int btree_find_depth(DiskInterface* disk, cache *cache, uint64_t node_block)
+typedef struct btree_message_t
 {
-	BTreeNode node;
-	btree_node_read(disk, cache, node_block, &node);
-	
-	int depth=0;
-	while (true) {
-		if (node.is_leaf) {
-			return depth;  // Reached a leaf, return current depth
-		}
+	uint64_t key;
+	uint64_t value;
+	uint8_t op;                  // BTREE_MSG_*
+} btree_message_t;
+
+#define BTREE_MSG_INSERT 1       // Insert the key if it is absent
+#define BTREE_MSG_UPSERT 2       // Set the key's value, inserting it if absent
+#define BTREE_MSG_DELETE 3       // Remove the key if present
+
+#define BTREE_BUFFER_CAPACITY ((BLOCK_SIZE - BTREE_NODE_END - sizeof(uint64_t)) / sizeof(btree_message_t))
+
+// Most children a node can have while a flushed batch is spliced into it
+#define BTREE_RUN_MAX (BTREE_BUFFER_CAPACITY + MAX_KEYS + 2)
+
+/**
+ * Message buffer kept in the rest of an internal node's block
+ * Only buffered trees put messages in it; everywhere else it stays empty
+ */
+typedef struct btree_buffer_t
+{
+	uint16_t count;              // Number of messages
+	btree_message_t messages[BTREE_BUFFER_CAPACITY];
+} btree_buffer_t;
+
+static btree_buffer_t *btree_buffer(void *block)
+{
+	return (btree_buffer_t*)((char*)block + BTREE_NODE_END);
+}
+
+static uint16_t btree_buffer_count(DiskInterface* disk, cache *cache, uint64_t block)
+{
+	return btree_buffer(get_block(disk, cache, 0, block))->count;
+}
+
+// Copy the buffer of a node block into memory
+static void btree_buffer_read(DiskInterface* disk, cache *cache, uint64_t block, btree_buffer_t *buffer)
+{
+	btree_buffer_t *stored = btree_buffer(get_block(disk, cache, 0, block));
+	buffer->count = stored->count;
+	memcpy(buffer->messages, stored->messages, stored->count * sizeof(btree_message_t));
+}
+
+// Replace the buffer of a node block, dirtying only the messages it holds
+static void btree_buffer_write(DiskInterface* disk, cache *cache, uint64_t block, btree_buffer_t *buffer)
+{
+	write_block_range(disk, cache, buffer, 0, block, BTREE_NODE_END, offsetof(btree_buffer_t, messages) + buffer->count * sizeof(btree_message_t));
+}
+
+// Append n messages to the buffer of a node block; the caller makes sure they fit
+static void btree_buffer_push(DiskInterface* disk, cache *cache, uint64_t block, const btree_message_t *messages, int n)
+{
+	uint16_t count = btree_buffer_count(disk, cache, block);
 	
-		// Follow the leftmost child
-		if (node.children[0] != 0) {
-			btree_node_read(disk, cache, node.children[0], &node);
-			depth++;
-		} else {
-			printf("ERROR: Node is not leaf and child not found!!\n");
-			return -1;
-		}
-	}
+	write_block_range(disk, cache, messages, 0, block, BTREE_NODE_END + offsetof(btree_buffer_t, messages) + count * sizeof(btree_message_t), n * sizeof(btree_message_t));
+	count += n;
+	write_block_range(disk, cache, &count, 0, block, BTREE_NODE_END, sizeof(uint16_t));
 }
 
 /**
- * Find the height of the B-tree from a given node
- * Height is the number of levels from this node to the deepest leaf
+ * Move the messages for keys in [low, high] from one node's buffer to the
+ * end of another's, keeping their order
+ * Used when part of a node's key range is handed to another node.
+ * @return 0 on success, -1 if they don't fit (nothing is moved then)
  */
-int btree_find_height(DiskInterface* disk, cache *cache, uint64_t node_block)
+static int btree_buffer_move(DiskInterface* disk, cache *cache, uint64_t from, uint64_t to, uint64_t low, uint64_t high)
 {
-	BTreeNode node;
-	btree_node_read(disk, cache, node_block, &node);
-	
-	// Special case: single node tree
-	if (node.parent==0 && node.children[0]==0) return 0;
+	btree_buffer_t buffer;
+	btree_buffer_t moved;
+	btree_buffer_read(disk, cache, from, &buffer);
 	
-	int height=0;
-	// Follow leftmost path to count levels
-	while (!node.is_leaf)
-	{
-		btree_node_read(disk, cache, node.children[0], &node);
-		height++;
+	int kept = 0;
+	moved.count = 0;
+	for (int i = 0; i < buffer.count; i++) {
+		btree_message_t *message = &buffer.messages[i];
+		if (message->key >= low && message->key <= high) moved.messages[moved.count++] = *message;
+		else buffer.messages[kept++] = *message;
 	}
-	return height;
+	if (moved.count == 0) return 0;
+	if (btree_buffer_count(disk, cache, to) + moved.count > BTREE_BUFFER_CAPACITY) return -1;
+	
+	btree_buffer_push(disk, cache, to, moved.messages, moved.count);
+	buffer.count = kept;
+	btree_buffer_write(disk, cache, from, &buffer);
+	return 0;
+}
+
+// Whether the buffers of two nodes fit in one
+static bool btree_buffer_fits(DiskInterface* disk, cache *cache, uint64_t a, uint64_t b)
+{
+	return btree_buffer_count(disk, cache, a) + btree_buffer_count(disk, cache, b) <= BTREE_BUFFER_CAPACITY;
 }
 
 /**
- * Find the minimum key in a B-tree subtree
- * Recursively follows the leftmost path to find the smallest key
+ * Copy of an internal node in a tree's routing table
+ * Aligned so the separators a lookup compares sit in one cache line
  */
-int btree_find_minimum(DiskInterface* disk, cache *cache, uint64_t root_block)
+typedef struct __attribute__((aligned(64))) btree_route_node_t
 {
-	BTreeNode root;
-	btree_node_read(disk, cache, root_block, &root);
-	
-	// Follow leftmost child until we reach a leaf
-	BTreeNode first_child;
-	btree_node_read(disk, cache, root.children[0], &first_child);
-	if (first_child.is_leaf) return first_child.key;
-	else return btree_find_minimum(disk, cache, first_child.block_number);
+	uint64_t keys[MAX_KEYS];     // Separators, as in the node
+	uint16_t num_keys;
+	uint32_t first;              // Table index of children[0] on the next routed level
+	uint64_t children[MAX_KEYS + 1]; // Child block numbers
+} btree_route_node_t;
+
+/**
+ * The upper levels of a tree, mirrored in memory
+ * Nodes are stored level by level, so the routed children of a node are
+ * contiguous. A descent walks the table instead of going through
+ * get_block for the nodes every lookup touches. Any change to a routed
+ * node drops the table; the next descent rebuilds it.
+ */
+typedef struct btree_route_t
+{
+	cache *cache;
+	uint64_t root_block;         // Tree the table routes
+	bool valid;                  // Table matches the tree
+	int levels;                  // Number of routed levels
+	btree_route_node_t *nodes;   // BTREE_ROUTE_MAX_NODES nodes
+	struct btree_route_t *next;  // Next table in the hash bucket
+} btree_route_t;
+
+static btree_route_t *btree_routes[BTREE_ROUTES];
+
+static btree_route_t *btree_route(cache *cache, uint64_t root_block)
+{
+	btree_route_t *route = btree_routes[root_block % BTREE_ROUTES];
+	while (route && (route->root_block != root_block || route->cache != cache)) route = route->next;
+	return route;
 }
 
 /**
- * Find the maximum key in a B-tree subtree
- * Recursively follows the rightmost path to find the largest key
+ * Route lookups in a tree through an in-memory copy of its upper levels
  */
-uint64_t btree_find_maximum(DiskInterface* disk, cache *cache, uint64_t root_block)
+void btree_route_enable(cache *cache, uint64_t root_block)
 {
-	BTreeNode root;
-	btree_node_read(disk, cache, root_block, &root);
-	
-	// Base case: if this is a leaf, return its key
-	if (root.is_leaf) return root.key;
+	if (btree_route(cache, root_block)) return;
 	
-	// Find the rightmost non-null child and recurse
-	for (int i = root.num_keys; i >= 0; i--) {
-		if (root.children[i] != 0) {
-			return btree_find_maximum(disk, cache, root.children[i]);
-		}
-	}
-	
-	return 0;  // Should not reach here in a valid tree
+	btree_route_t *route = malloc(sizeof(btree_route_t));
+	route->next = btree_routes[root_block % BTREE_ROUTES];
+	btree_routes[root_block % BTREE_ROUTES] = route;
+	route->cache = cache;
+	route->root_block = root_block;
+	route->valid = false;
+	route->levels = 0;
+	route->nodes = aligned_alloc(64, BTREE_ROUTE_MAX_NODES * sizeof(btree_route_node_t));
 }
 
 /**
- * Insert a node into a non-full internal node
- * Finds the correct position and shifts existing children as needed
+ * Stop routing a tree's lookups in memory and free its table
  */
-int btree_insert_nonfull(DiskInterface* disk, cache *cache, BTreeNode *root, BTreeNode *node)
+void btree_route_disable(cache *cache, uint64_t root_block)
 {
-	if (root->is_leaf) {
-		printf("ERROR: Trying to insert into leaf node\n");
-		return -1;
-	} else {
-		// Find the correct position for the new child
-		int child_pos = 0;
-		for(int j = 0; j <= root->num_keys; j++) {
-			if(root->children[j] != 0) {
-				BTreeNode *child = (BTreeNode*)get_block(disk, cache, 0, root->children[j]);
-				if(child->is_leaf && child->key < node->key) {
-					child_pos = j + 1;
-				} else if(!child->is_leaf) {
-					uint64_t max_key = btree_find_maximum(disk, cache, child->block_number);
-					if(max_key < node->key) {
-						child_pos = j + 1;
-					}
-				}
-			}
-		}
-		
-		// Shift existing children to make room
-		for(int j = root->num_keys; j >= child_pos; j--) {
-			root->children[j + 1] = root->children[j];
-		}
-		
-		// Insert the new child
-		root->children[child_pos] = node->block_number;
-		node->parent = root->block_number;
-		root->num_keys++;
-		
-		// Update keys based on maximum values of children
-		for(int i = 0; i < root->num_keys; i++) {
-			if(root->children[i] != 0) {
-				root->keys[i] = btree_find_maximum(disk, cache, root->children[i]);
-			}
-		}
-		
-		printf("Placing node with key %lu at child position %d\n", node->key, child_pos);
-		printf("Block number = %lu\n", node->block_number);
-	}
+	btree_route_t **link = &btree_routes[root_block % BTREE_ROUTES];
+	while (*link && ((*link)->cache != cache || (*link)->root_block != root_block)) link = &(*link)->next;
+	btree_route_t *route = *link;
+	if (!route) return;
 	
-	return 0;
+	*link = route->next;
+	free(route->nodes);
+	free(route);
 }
 
-int btree_insertion_search(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+/**
+ * Drop a tree's routing table if a node at the given level changed
+ * Levels below the routed ones can change freely
+ */
+static void btree_route_touch(cache *cache, uint64_t root_block, int level)
 {
-	BTreeNode root;
-	btree_node_read(disk, cache, root_block, &root);
+	btree_route_t *route = btree_route(cache, root_block);
+	if (route && level < route->levels) route->valid = false;
+}
+
+// Mirror the upper levels of the tree, breadth first
+static void btree_route_build(DiskInterface* disk, cache *cache, btree_route_t *route)
+{
+	BTreeNode node;
+	int start = 0;
+	int count = 1;
+	uint64_t level_blocks[BTREE_ROUTE_MAX_NODES];
+	level_blocks[0] = route->root_block;
 	
-	if (root.children[0] == 0) {
-		return root.block_number;
-	}
+	route->levels = 0;
+	route->valid = true;
+	while (route->levels < BTREE_ROUTE_LEVELS) {
+		int next_count = 0;
+		uint64_t next_blocks[BTREE_ROUTE_MAX_NODES];
 	
-	if (btree_find_depth(disk, cache, root_block)-1 <= 0) {
-		return root.block_number;
-	}
+		for (int n = 0; n < count; n++) {
+			btree_node_read(disk, cache, level_blocks[n], &node);
 	
-	BTreeNode node;
-	memcpy(&node, &root, sizeof(struct BTreeNode));
-	int current_depth = 0;
-	while (current_depth < btree_find_depth(disk, cache, root_block)-1) {
-		int child_index = 0;
-		
-		for (int i = 0; i < node.num_keys; i++) {
-			if (node.children[i] != 0) {
-				uint64_t child_max = btree_find_maximum(disk, cache, node.children[i]);
-				if (key <= child_max) {
-					child_index = i;
-					break;
-				}
-				child_index = i + 1;
-			}
-		}
-		
-		if (child_index > node.num_keys) {
-			child_index = node.num_keys;
-		}
-		
-		bool descended = false;
-		if (node.children[child_index] != 0) {
-			btree_node_read(disk, cache, node.children[child_index], &node);
-			current_depth++;
-			descended = true;
-		} else {
-			for (int i = node.num_keys; i >= 0; i--) {
-				if (node.children[i] != 0) {
-					btree_node_read(disk, cache, node.children[i], &node);
-					current_depth++;
-					descended = true;
-					break;
-				}
+			// Leaves, and an empty root, end the routed levels
+			if (node.is_leaf || node.children[0] == 0) return;
+			if (start + count + next_count + node.num_keys + 1 > BTREE_ROUTE_MAX_NODES) return;
+	
+			btree_route_node_t *route_node = &route->nodes[start + n];
+			route_node->num_keys = node.num_keys;
+			route_node->first = start + count + next_count;
+			for (int i = 0; i < node.num_keys; i++) route_node->keys[i] = node.keys[i];
+			for (int i = 0; i <= node.num_keys; i++) {
+				route_node->children[i] = node.children[i];
+				next_blocks[next_count++] = node.children[i];
 			}
 		}
-		
-		if (!descended) {
-			break;
-		}
-	}
 	
-	return node.block_number;
+		route->levels++;
+		start += count;
+		count = next_count;
+		memcpy(level_blocks, next_blocks, count * sizeof(uint64_t));
+	}
 }
 
 /**
- * Update parent node keys after a child modification
- * Ensures parent keys reflect the maximum values of their child subtrees
+ * Descend from the root to the leaf that holds or would hold a key
+ * Records every internal node visited, and the child taken out of it, in path.
+ * The levels of a routed tree are taken from its routing table.
  */
-void btree_update_parent_keys(DiskInterface* disk, cache *cache, BTreeNode* node)
+uint64_t btree_descend(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, BTreePath *path)
 {
-	if (node->parent == 0) return;  // No parent to update
+	BTreeNode node;
+	uint64_t block = root_block;
+	path->depth = 0;
 	
-	BTreeNode parent;
-	btree_node_read(disk, cache, node->parent, &parent);
+	btree_route_t *route = btree_route(cache, root_block);
+	if (route) {
+		if (!route->valid) btree_route_build(disk, cache, route);
 	
-	// Update all keys in the parent based on the maximum values of each child
-	for (int i = 0; i < parent.num_keys; i++) {
-		if (parent.children[i] != 0) {
-			parent.keys[i] = btree_find_maximum(disk, cache, parent.children[i]);
+		uint32_t r = 0;
+		for (int level = 0; level < route->levels; level++) {
+			btree_route_node_t *route_node = &route->nodes[r];
+			int i;
+			for (i = 0; i < route_node->num_keys && key > route_node->keys[i]; i++);
+			path->blocks[path->depth] = block;
+			path->index[path->depth] = i;
+			path->depth++;
+			block = route_node->children[i];
+			r = route_node->first + i;
 		}
 	}
 	
-	btree_node_write(disk, cache, &parent);
-}
-
-int btree_insert(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value)
-{
-	BTreeNode *node = btree_node_create(disk, cache, true);
-	node->key = key;
-	node->value = value;
+	while (true) {
+		btree_node_read(disk, cache, block, &node);
+		if (node.is_leaf) return block;
 	
-	int target_block = btree_insertion_search(disk, cache, root_block, key);
-	BTreeNode target;
-	btree_node_read(disk, cache, target_block, &target);
+		int i = btree_child_index(&node, key);
+		path->blocks[path->depth] = block;
+		path->index[path->depth] = i;
+		path->depth++;
 	
-	if (target.num_keys == MAX_KEYS) {
-		if (target.keys[MAX_KEYS - 1] < key && target.children[MAX_KEYS]==0)
-		{
-			target.children[MAX_KEYS]=node->block_number;
-			node->parent=target.block_number;
-		} else {
-			if (target.parent != 0) {
-				BTreeNode parent;
-				btree_node_read(disk, cache, target.parent, &parent);
-				int i;
-				for(i=0; i<MAX_KEYS && parent.keys[i] < btree_find_maximum(disk, cache, target.block_number) && parent.keys[i]!=0; i++);
-				btree_split_child(disk, cache, &parent, i, &target);
-				target_block = btree_insertion_search(disk, cache, root_block, key);
-				btree_node_read(disk, cache, target_block, &target);
-			} else {
-				btree_split_root(disk, cache, &target);
-				target_block = btree_insertion_search(disk, cache, root_block, key);
-				btree_node_read(disk, cache, target_block, &target);
-			}
-			btree_insert_nonfull(disk, cache, &target, node);
-			btree_node_write(disk, cache, &target);
-		}
-	}
-	else
-	{
-		btree_insert_nonfull(disk, cache, &target, node);
-		btree_node_write(disk, cache, &target);
+		// Only an empty root has no child to follow
+		if (node.children[i] == 0) return 0;
+		block = node.children[i];
 	}
-
-	btree_update_parent_keys(disk, cache, node);
-	
-	return 0;
 }
 
 /**
- * Borrow a child from the left sibling to rebalance the tree
- * Used during deletion when a node becomes too small
+ * Bloom filter attached to a tree
+ * The filter bits live in memory and are written through to dedicated
+ * blocks bucket by bucket, so a filter can be reopened after a remount.
+ * Deleted keys can't be taken out of the filter; they only cost false
+ * positives until enough of them pile up to rebuild it from the leaves.
  */
-int btree_borrow_left(DiskInterface* disk, cache *cache, BTreeNode *node)
+typedef struct btree_filter_t
 {
-	int rv = -1;
-	if (node->left_sibling==0) return rv;  // No left sibling
-	else {
-		BTreeNode left_sibling;
-		btree_node_read(disk, cache, node->left_sibling, &left_sibling);
-		
-		// Can't borrow if sibling has minimum keys
-		if (left_sibling.num_keys==MIN_KEYS) return rv;
-		else {
-			// Find the rightmost child to borrow
-			for (int i = left_sibling.num_keys; i >= 0; i--) {
-				if (left_sibling.children[i] != 0) {
-					if (i < left_sibling.num_keys) left_sibling.keys[i]=0;
-					rv = left_sibling.children[i];  // Return borrowed child
-					left_sibling.children[i] = 0;
-					left_sibling.num_keys--;
-					break;
-				}
-			}
-		}
-		btree_node_write(disk, cache, &left_sibling);
-	}
-	return rv;
-}
+	cache *cache;
+	uint64_t root_block;
+	uint64_t header_block;       // Block holding the filter layout
+	Bloom *bloom;
+	uint64_t *blocks;            // Blocks holding the filter bits
+	uint64_t nblocks;
+	uint64_t keys;               // Keys added since the last rebuild
+	uint64_t deletes;            // Keys deleted since the last rebuild
+	bool stale;                  // Rebuild before the next lookup
+	struct btree_filter_t *next; // Next filter in the hash bucket
+} btree_filter_t;
 
 /**
- * Borrow a child from the right sibling to rebalance the tree
- * Used during deletion when a node becomes too small
+ * Layout of a filter's header block, stored after the block type byte
  */
-int btree_borrow_right(DiskInterface* disk, cache *cache, BTreeNode *node)
+typedef struct btree_filter_header_t
 {
-	int rv = -1;
-	if (node->right_sibling==0) return rv;  // No right sibling
-	else {
-		BTreeNode right_sibling;
-		btree_node_read(disk, cache, node->right_sibling, &right_sibling);
-		
-		// Can't borrow if sibling has minimum keys
-		if (right_sibling.num_keys==MIN_KEYS) return rv;
-		else {
-			// Borrow the leftmost child
-			rv = right_sibling.children[0];
-			
-			// Shift all keys and children left
-			for(int i = 0; i < MAX_KEYS; i++) {
-				right_sibling.keys[i] = right_sibling.keys[i+1];
-			}
-			for(int i = 0; i <= MAX_KEYS; i++) {
-				right_sibling.children[i] = right_sibling.children[i+1];
-			}
-			right_sibling.keys[MAX_KEYS-1] = 0;
-			right_sibling.children[MAX_KEYS] = 0;
-			right_sibling.num_keys--;
-		}
-		btree_node_write(disk, cache, &right_sibling);
-	}
-	return rv;
+	uint64_t buckets;            // Number of filter buckets
+	uint64_t nblocks;            // Number of blocks holding them
+	uint64_t blocks[];           // Block numbers in bucket order
+} btree_filter_header_t;
+
+#define BTREE_FILTER_BUCKET_BYTES (BLOOM_BUCKET_WORDS * sizeof(uint64_t))
+#define BTREE_FILTER_BUCKETS_PER_BLOCK ((BLOCK_SIZE - 1) / BTREE_FILTER_BUCKET_BYTES)
+#define BTREE_FILTER_MAX_BLOCKS ((BLOCK_SIZE - 1 - sizeof(btree_filter_header_t)) / sizeof(uint64_t))
+
+static btree_filter_t *btree_filters[BTREE_FILTERS];
+
+static btree_filter_t *btree_filter(cache *cache, uint64_t root_block)
+{
+	btree_filter_t *filter = btree_filters[root_block % BTREE_FILTERS];
+	while (filter && (filter->cache != cache || filter->root_block != root_block)) filter = filter->next;
+	return filter;
 }
 
-void btree_remove_key(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+// Write buckets [first, first+count) of the filter to its blocks
+static void btree_filter_write(DiskInterface* disk, cache *cache, btree_filter_t *filter, uint64_t first, uint64_t count)
 {
-	BTreeNode root;
-	btree_node_read(disk, cache, root_block, &root);
-	int i;
-	for(i=0; i<MAX_KEYS && root.keys[i] < key && root.keys[i]!=0; i++);
-	BTreeNode *node = (BTreeNode*)get_block(disk, cache, 0, root.children[i]);
-	BTreeNode borrowed;
-	int rv;
-	if (root.num_keys==MIN_KEYS && root.parent!=0)
-	{
-		rv = btree_borrow_left(disk, cache, &root);
-		if (rv==-1) {
-			rv = btree_borrow_right(disk, cache, &root);
-			if (rv==-1) {
-				BTreeNode grandparent;
-				btree_node_read(disk, cache, root.parent, &grandparent);
-				int j;
-				for(j=0; j<MAX_KEYS && grandparent.keys[j] < key && grandparent.keys[j]!=0; j++);
-				btree_merge_children(disk, cache, &grandparent, j);
-				btree_node_write(disk, cache, &grandparent);
-			}
-		}
-	}
-	for(i=0; i<MAX_KEYS && root.keys[i] < key && root.keys[i]!=0; i++);
-	printf("Removing key %ld from block %ld\n", key, root_block);
-	for(int j=i; j<root.num_keys; j++)
-	{
-		root.keys[j] = root.keys[j+1];
-	}
-	for(int j=i; j<=root.num_keys; j++)
-	{
-		root.children[j] = root.children[j+1];
-	}
-	root.keys[root.num_keys-1] = 0;
-	root.children[root.num_keys] = 0;
-	root.num_keys--;
-	if (root.num_keys==0)
-	{
-		root.keys[0] = btree_find_maximum(disk, cache, root_block);
-		root.num_keys++;
-	}
-	
-	if (rv!=-1) {
-		btree_node_read(disk, cache, rv, &borrowed);
-		btree_insert_nonfull(disk, cache, &root, &borrowed);
+	while (count > 0) {
+		uint64_t slot = first % BTREE_FILTER_BUCKETS_PER_BLOCK;
+		uint64_t run = BTREE_FILTER_BUCKETS_PER_BLOCK - slot;
+		if (run > count) run = count;
+		write_block_range(disk, cache, &filter->bloom->bits[first * BLOOM_BUCKET_WORDS], 0,
+			filter->blocks[first / BTREE_FILTER_BUCKETS_PER_BLOCK],
+			1 + slot * BTREE_FILTER_BUCKET_BYTES, run * BTREE_FILTER_BUCKET_BYTES);
+		first += run;
+		count -= run;
 	}
-	btree_update_parent_keys(disk, cache, node);
-	btree_node_write(disk, cache, &root);
-	
-	return;
 }
 
-int btree_delete(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+// Add the keys of the leaves under a node to the filter
+static void btree_filter_fill(DiskInterface* disk, cache *cache, btree_filter_t *filter, uint64_t block)
 {
-	int rv = btree_search(disk, cache, root_block, key);
 	BTreeNode node;
-	
-	if (rv!=-1)
-	{
-		btree_node_read(disk, cache, rv, &node);
-		btree_remove_key(disk, cache, node.parent, key);
-		btree_node_free(disk, cache, &node);
+	btree_node_read(disk, cache, block, &node);
+	if (node.is_leaf) {
+		bloom_add(filter->bloom, node.key);
+		filter->keys++;
+		return;
+	}
+	for (int i = 0; i <= node.num_keys && node.children[i] != 0; i++) {
+		btree_filter_fill(disk, cache, filter, node.children[i]);
 	}
-	
-	return rv;
 }
 
-void btree_split_root(DiskInterface* disk, cache *cache, BTreeNode* root)
+// Refill the filter from the tree and write all of it out
+// The tree is walked rather than the leaf chain, which copy-on-write writes don't keep up.
+static void btree_filter_rebuild(DiskInterface* disk, cache *cache, btree_filter_t *filter)
 {
-	BTreeNode *child_a = btree_node_create(disk, cache, false);
-	BTreeNode *child_b = btree_node_create(disk, cache, false);
-	child_a->right_sibling = child_b->block_number;
-	child_b->left_sibling = child_a->block_number;
+	bloom_clear(filter->bloom);
+	filter->keys = 0;
+	btree_filter_fill(disk, cache, filter, filter->root_block);
 	
-	for (int i = 0; i < MIN_KEYS; i++) {
-		child_a->keys[i] = root->keys[i];
-		child_a->children[i] = root->children[i];
-		if (root->children[i] != 0) {
-			BTreeNode *child = (BTreeNode*)get_block(disk, cache, 0, root->children[i]);
-			child->parent = child_a->block_number;
-		}
-		child_a->num_keys++;
-	}
-	child_a->children[MIN_KEYS] = root->children[MIN_KEYS];
-	if (root->children[MIN_KEYS] != 0) {
-		BTreeNode *child = (BTreeNode*)get_block(disk, cache, 0, root->children[MIN_KEYS]);
-		child->parent = child_a->block_number;
-	}
+	btree_filter_write(disk, cache, filter, 0, filter->bloom->buckets);
+	filter->deletes = 0;
+	filter->stale = false;
+}
+
+// Attach a filter to a tree, replacing the one it had
+static btree_filter_t *btree_filter_attach(cache *cache, uint64_t root_block, uint64_t header_block, Bloom *bloom, uint64_t nblocks)
+{
+	btree_filter_close(cache, root_block);
 	
-	for (int i = MIN_KEYS + 1; i < root->num_keys; i++) {
-		child_b->keys[i - MIN_KEYS - 1] = root->keys[i];
-		child_b->num_keys++;
-	}
-	for (int i = MIN_KEYS + 1; i <= root->num_keys; i++) {
-		child_b->children[i - MIN_KEYS - 1] = root->children[i];
-		if (root->children[i] != 0) {
-			BTreeNode *child = (BTreeNode*)get_block(disk, cache, 0, root->children[i]);
-			child->parent = child_b->block_number;
-		}
-	}
+	btree_filter_t *filter = malloc(sizeof(btree_filter_t));
+	filter->next = btree_filters[root_block % BTREE_FILTERS];
+	btree_filters[root_block % BTREE_FILTERS] = filter;
+	filter->cache = cache;
+	filter->root_block = root_block;
+	filter->header_block = header_block;
+	filter->bloom = bloom;
+	filter->blocks = malloc(nblocks * sizeof(uint64_t));
+	filter->nblocks = nblocks;
+	filter->keys = 0;
+	filter->deletes = 0;
+	filter->stale = false;
+	return filter;
+}
+
+/**
+ * Attach a new Bloom filter to a tree, filled with the keys it holds
+ */
+uint64_t btree_filter_create(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t expected_keys)
+{
+	BTreeNode root;
+	btree_node_read(disk, cache, root_block, &root);
+	uint64_t keys = 0;
+	for (int i = 0; i <= root.num_keys; i++) keys += root.counts[i];
+	if (expected_keys < keys) expected_keys = keys;
 	
-	if (root->children[MAX_KEYS] != 0) {
-		child_b->children[child_b->num_keys] = root->children[MAX_KEYS];
-		BTreeNode *child = (BTreeNode*)get_block(disk, cache, 0, root->children[MAX_KEYS]);
-		child->parent = child_b->block_number;
+	Bloom *bloom = bloom_create(expected_keys);
+	uint64_t nblocks = (bloom->buckets + BTREE_FILTER_BUCKETS_PER_BLOCK - 1) / BTREE_FILTER_BUCKETS_PER_BLOCK;
+	if (nblocks > BTREE_FILTER_MAX_BLOCKS) {
+		bloom_free(bloom);
+		nblocks = BTREE_FILTER_MAX_BLOCKS;
+		bloom = bloom_create_buckets(nblocks * BTREE_FILTER_BUCKETS_PER_BLOCK);
 	}
 	
-	root->is_leaf = false;
-	root->num_keys = 1;
-	root->children[0] = child_a->block_number;
-	root->children[1] = child_b->block_number;
+	uint64_t header_block = alloc_page(disk, cache);
+	btree_filter_t *filter = btree_filter_attach(cache, root_block, header_block, bloom, nblocks);
+	for (uint64_t i = 0; i < nblocks; i++) filter->blocks[i] = alloc_page(disk, cache);
 	
-	// Clear remaining slots
-	for (int i = 1; i < MAX_KEYS; i++) {
-		root->keys[i] = 0;
-	}
-	for (int i = 2; i <= MAX_KEYS; i++) {
-		root->children[i] = 0;
-	}
+	btree_filter_header_t header = { bloom->buckets, nblocks };
+	write_block_range(disk, cache, &header, 0, header_block, 1, sizeof(btree_filter_header_t));
+	write_block_range(disk, cache, filter->blocks, 0, header_block, 1 + sizeof(btree_filter_header_t), nblocks * sizeof(uint64_t));
 	
-	child_a->parent = root->block_number;
-	child_b->parent = root->block_number;
-	root->keys[0] = btree_find_maximum(disk, cache, child_a->block_number);
+	btree_filter_rebuild(disk, cache, filter);
+	return header_block;
 }
 
-void btree_promote_root(DiskInterface* disk, cache *cache, BTreeNode* root)
+/**
+ * Attach a Bloom filter saved by btree_filter_create to a tree
+ */
+int btree_filter_open(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t header_block)
 {
-	int page = root->block_number;
-	
-	BTreeNode child;
-	btree_node_read(disk, cache, root->children[0], &child);
-	
-	memcpy(root, &child, sizeof(struct BTreeNode));
+	btree_filter_header_t *header = (btree_filter_header_t*)( (block_type_t*) (get_block(disk, cache, 0, header_block) + 1) );
+	if (header->nblocks == 0 || header->nblocks > BTREE_FILTER_MAX_BLOCKS ||
+		header->buckets > header->nblocks * BTREE_FILTER_BUCKETS_PER_BLOCK) return -1;
 	
-	root->block_number = page;
-	root->parent = 0;
+	uint64_t nblocks = header->nblocks;
+	Bloom *bloom = bloom_create_buckets(header->buckets);
+	btree_filter_t *filter = btree_filter_attach(cache, root_block, header_block, bloom, nblocks);
 	
-	btree_node_free(disk, cache, &child);
+	// The header may be evicted by the reads below, so copy the block list first
+	memcpy(filter->blocks, header->blocks, nblocks * sizeof(uint64_t));
 	
-	for (int i = 0; i <= root->num_keys; i++) {
-		if (root->children[i] != 0) {
-			btree_node_read(disk, cache, root->children[i], &child);
-			child.parent = root->block_number;
-			btree_node_write(disk, cache, &child);
-		}
+	for (uint64_t first = 0; first < bloom->buckets; first += BTREE_FILTER_BUCKETS_PER_BLOCK) {
+		uint64_t run = bloom->buckets - first;
+		if (run > BTREE_FILTER_BUCKETS_PER_BLOCK) run = BTREE_FILTER_BUCKETS_PER_BLOCK;
+		void *ptr = get_block(disk, cache, 0, filter->blocks[first / BTREE_FILTER_BUCKETS_PER_BLOCK]);
+		memcpy(&bloom->bits[first * BLOOM_BUCKET_WORDS], (char*)ptr + 1, run * BTREE_FILTER_BUCKET_BYTES);
 	}
+	
+	BTreeNode root;
+	btree_node_read(disk, cache, root_block, &root);
+	for (int i = 0; i <= root.num_keys; i++) filter->keys += root.counts[i];
+	return 0;
 }
 
-void btree_split_child(DiskInterface* disk, cache *cache, BTreeNode* node, int index, BTreeNode* child)
-{
-	BTreeNode *child_b = btree_node_create(disk, cache, false);
-	child_b->parent = node->block_number;
-	child->right_sibling = child_b->block_number;
-	child_b->left_sibling = child->block_number;
+/**
+ * Detach a tree's Bloom filter
+ * Its blocks stay allocated, so it can be opened again
+ */
+void btree_filter_close(cache *cache, uint64_t root_block)
+{
+	btree_filter_t **link = &btree_filters[root_block % BTREE_FILTERS];
+	while (*link && ((*link)->cache != cache || (*link)->root_block != root_block)) link = &(*link)->next;
+	btree_filter_t *filter = *link;
+	if (!filter) return;
 	
-	for (int i = MIN_KEYS + 1; i < child->num_keys; i++) {
-		child_b->keys[i - MIN_KEYS - 1] = child->keys[i];
-		child->keys[i] = 0;
-		child_b->num_keys++;
-	}
+	*link = filter->next;
+	bloom_free(filter->bloom);
+	free(filter->blocks);
+	free(filter);
+}
+
+/**
+ * Check a tree's Bloom filter for a key before descending
+ * @return false if the key is definitely not in the tree
+ */
+static bool btree_filter_check(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+{
+	btree_filter_t *filter = btree_filter(cache, root_block);
+	if (!filter) return true;
+	
+	if (filter->stale) btree_filter_rebuild(disk, cache, filter);
+	return bloom_may_contain(filter->bloom, key);
+}
+
+// Add an inserted key to the tree's filter, writing back the bucket it set bits in
+static void btree_filter_add(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+{
+	btree_filter_t *filter = btree_filter(cache, root_block);
+	if (!filter) return;
+	
+	btree_filter_write(disk, cache, filter, bloom_add(filter->bloom, key), 1);
+	filter->keys++;
+}
+
+// Count a deleted key, and schedule a rebuild once they cost too many false positives
+static void btree_filter_remove(cache *cache, uint64_t root_block)
+{
+	btree_filter_t *filter = btree_filter(cache, root_block);
+	if (!filter) return;
+	
+	filter->deletes++;
+	if (filter->deletes * 100 > filter->keys * BTREE_FILTER_REBUILD_PERCENT) filter->stale = true;
+}
+
+/**
+ * Memtable absorbing the writes to a tree
+ * Inserts, upserts and deletes land in the skiplist and reach the tree in
+ * key order once it fills up or is flushed. There is no write-ahead log
+ * behind it, so writes are only as durable as the last flush.
+ */
+typedef struct btree_memtable_t
+{
+	cache *cache;
+	uint64_t root_block;         // Tree the writes belong to
+	MemTable *memtable;          // NULL while the table is being flushed
+	struct btree_memtable_t *next; // Next memtable in the hash bucket
+} btree_memtable_t;
+
+static btree_memtable_t *btree_memtables[BTREE_MEMTABLES];
+
+static btree_memtable_t *btree_memtable_slot(cache *cache, uint64_t root_block)
+{
+	btree_memtable_t *slot = btree_memtables[root_block % BTREE_MEMTABLES];
+	while (slot && (slot->root_block != root_block || slot->cache != cache)) slot = slot->next;
+	return slot;
+}
+
+static MemTable *btree_memtable(cache *cache, uint64_t root_block)
+{
+	btree_memtable_t *slot = btree_memtable_slot(cache, root_block);
+	return slot ? slot->memtable : NULL;
+}
+
+// Block of the leaf holding key, or 0 if the tree doesn't have it
+static uint64_t btree_find_leaf(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, BTreeNode *leaf)
+{
+	BTreePath path;
+	if (!btree_filter_check(disk, cache, root_block, key)) return 0;
 	
-	for (int i = MIN_KEYS + 1; i <= child->num_keys; i++) {
-		child_b->children[i - MIN_KEYS - 1] = child->children[i];
-		if (child_b->children[i - MIN_KEYS - 1] != 0) {
-			BTreeNode *grandchild = (BTreeNode*)get_block(disk, cache, 0, child_b->children[i - MIN_KEYS - 1]);
-			grandchild->parent = child_b->block_number;
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, key, &path);
+	if (leaf_block == 0) return 0;
+	btree_node_read(disk, cache, leaf_block, leaf);
+	return (leaf->key == key) ? leaf_block : 0;
+}
+
+// Whether a key is live, looking in the memtable before the tree
+static bool btree_memtable_lookup(DiskInterface* disk, cache *cache, uint64_t root_block, MemTable *memtable, uint64_t key, uint64_t *value)
+{
+	BTreeNode leaf;
+	int buffered = memtable_get(memtable, key, value);
+	if (buffered == 0 || buffered == 1) return buffered == 1;
+	
+	// A pending insert only holds the value if the tree doesn't have the key
+	if (btree_find_leaf(disk, cache, root_block, key, &leaf) == 0) return buffered == 2;
+	*value = leaf.value;
+	return true;
+}
+
+// Record a write in the memtable, flushing it first if it is full
+static void btree_memtable_put(DiskInterface* disk, cache *cache, uint64_t root_block, MemTable *memtable, uint64_t key, uint64_t value, bool deleted)
+{
+	if (memtable_put(memtable, key, value, deleted) == 0) return;
+	
+	btree_memtable_flush(disk, cache, root_block);
+	memtable_put(memtable, key, value, deleted);
+}
+
+/**
+ * A run of sorted batch keys that all route through the same node
+ */
+typedef struct btree_batch_group_t
+{
+	uint64_t block;              // Node the keys are at
+	int lo;                      // First key of the run in the sorted batch
+	int hi;                      // One past the last key of the run
+	int *outstanding;            // Node reads of the level still in flight
+	BTreeNode node;              // Copy of the node once it has been read
+} btree_batch_group_t;
+
+typedef struct btree_batch_key_t
+{
+	uint64_t key;
+	int slot;                    // Position of the key in the caller's array
+} btree_batch_key_t;
+
+static int btree_batch_key_cmp(const void *a, const void *b)
+{
+	uint64_t ka = ((const btree_batch_key_t*)a)->key;
+	uint64_t kb = ((const btree_batch_key_t*)b)->key;
+	return (ka > kb) - (ka < kb);
+}
+
+static void btree_batch_node_read(void *page, void *ctx)
+{
+	btree_batch_group_t *group = ctx;
+	memcpy(&group->node, (char*)page + 1, sizeof(struct BTreeNode));
+	(*group->outstanding)--;
+}
+
+/**
+ * Look up a batch of keys with one shared descent
+ * The keys are sorted and walked down the tree a level at a time: every
+ * node on a level is read once for all the keys routed through it, and all
+ * the level's reads are issued before any is waited on, so misses overlap
+ * (in the worker pool with cache_enable_async, as kernel read-ahead
+ * otherwise).
+ */
+int btree_multi_get(DiskInterface* disk, cache *cache, uint64_t root_block, const uint64_t *keys, int n, uint64_t *out)
+{
+	if (n <= 0) return 0;
+	
+	btree_batch_key_t *sorted = malloc(n * sizeof(btree_batch_key_t));
+	btree_batch_group_t *level = malloc(n * sizeof(btree_batch_group_t));
+	btree_batch_group_t *next = malloc(n * sizeof(btree_batch_group_t));
+	
+	// Keys the memtable knows about or the filter rules out don't take part in the descent
+	MemTable *memtable = btree_memtable(cache, root_block);
+	int found = 0;
+	int m = 0;
+	for (int i = 0; i < n; i++) {
+		out[i] = -1;
+		int buffered = memtable ? memtable_get(memtable, keys[i], &out[i]) : -1;
+		if (buffered == 0 || buffered == 1) {
+			found += buffered;
+			continue;
 		}
-		child->children[i] = 0;
+		
+		// A pending insert is settled once the tree has been looked at
+		out[i] = -1;
+		if (!btree_filter_check(disk, cache, root_block, keys[i])) continue;
+		sorted[m].key = keys[i];
+		sorted[m].slot = i;
+		m++;
 	}
+	qsort(sorted, m, sizeof(btree_batch_key_t), btree_batch_key_cmp);
 	
-	child->keys[MIN_KEYS] = 0;
-	child->num_keys = MIN_KEYS;
+	int count = (m > 0) ? 1 : 0;
+	level[0].block = root_block;
+	level[0].lo = 0;
+	level[0].hi = m;
 	
-	if (node->num_keys < MAX_KEYS) {
-		for (int i = node->num_keys; i > index; i--) {
-			node->children[i + 1] = node->children[i];
-		}
+	while (count > 0) {
+		int outstanding = count;
 		
-		node->children[index + 1] = child_b->block_number;
-		node->keys[index] = btree_find_maximum(disk, cache, child_b->block_number);
-		child_b->parent = node->block_number;
-		node->num_keys++;
-		for (int i = 0; i < node->num_keys; i++) {
-			if (node->children[i] != 0) {
-				node->keys[i] = btree_find_maximum(disk, cache, node->children[i]);
-			}
-		}
-	} else {
-		if (node->parent != 0) {
-			BTreeNode *grandparent = (BTreeNode*)get_block(disk, cache, 0, node->parent);
-			int parent_index;
-			for (parent_index = 0; parent_index <= grandparent->num_keys; parent_index++) {
-				if (grandparent->children[parent_index] == node->block_number) break;
+		// Issue every read of the level before waiting on any of them
+		if (!cache->aio) {
+			for (int g = 0; g < count; g++) {
+				if (pci_lookup(cache->pci, level[g].block) == -1) disk_prefetch(disk, level[g].block, 1);
 			}
-			btree_split_child(disk, cache, grandparent, parent_index, node);
-		} else {
-			btree_split_root(disk, cache, node);
 		}
-		
-		BTreeNode *current_parent = (BTreeNode*)get_block(disk, cache, 0, child->parent);
-		int new_index;
-		for (new_index = 0; new_index <= current_parent->num_keys; new_index++) {
-			if (current_parent->children[new_index] == child->block_number) break;
+		for (int g = 0; g < count; g++) {
+			level[g].outstanding = &outstanding;
+			get_block_async(disk, cache, 0, level[g].block, btree_batch_node_read, &level[g]);
 		}
-		
-		if (current_parent->num_keys < MAX_KEYS) {
-			for (int i = current_parent->num_keys; i > new_index; i--) {
-				current_parent->children[i + 1] = current_parent->children[i];
+		while (outstanding > 0) cache_poll(disk, cache, true);
+	
+		// Route each run of keys to the children of its node
+		int next_count = 0;
+		for (int g = 0; g < count; g++) {
+			BTreeNode *node = &level[g].node;
+			if (node->is_leaf) {
+				for (int i = level[g].lo; i < level[g].hi; i++) {
+					if (sorted[i].key != node->key) continue;
+					out[sorted[i].slot] = node->value;
+					found++;
+				}
+				continue;
 			}
-			
-			current_parent->children[new_index + 1] = child_b->block_number;
-			
-			current_parent->num_keys++;
-			for (int i = 0; i < current_parent->num_keys; i++) {
-				if (current_parent->children[i] != 0) {
-					current_parent->keys[i] = btree_find_maximum(disk, cache, current_parent->children[i]);
+	
+			int i = level[g].lo;
+			while (i < level[g].hi) {
+				int c = btree_child_index(node, sorted[i].key);
+				int j = i + 1;
+				while (j < level[g].hi && (c == node->num_keys || sorted[j].key <= node->keys[c])) j++;
+	
+				// Only an empty root has no child to follow
+				if (node->children[c] != 0) {
+					next[next_count].block = node->children[c];
+					next[next_count].lo = i;
+					next[next_count].hi = j;
+					next_count++;
 				}
+				i = j;
 			}
 		}
+	
+		btree_batch_group_t *tmp = level;
+		level = next;
+		next = tmp;
+		count = next_count;
+	}
+	
+	// Pending inserts of keys the tree doesn't have take effect
+	for (int i = 0; memtable && i < n; i++) {
+		uint64_t value;
+		if (out[i] == (uint64_t)-1 && memtable_get(memtable, keys[i], &value) == 2) {
+			out[i] = value;
+			found++;
+		}
 	}
+	
+	free(sorted);
+	free(level);
+	free(next);
+	return found;
 }
 
-void btree_merge_children(DiskInterface* disk, cache *cache, BTreeNode* parent, int index)
+/**
+ * Find the depth of a node in the B-tree
+ * Follows the leftmost path down to a leaf to determine depth
+ */
+int btree_find_depth(DiskInterface* disk, cache *cache, uint64_t node_block)
 {
-	if (index == MAX_KEYS) return btree_merge_children(disk, cache, parent, index-1);
-	else if (parent->children[index] == 0 || parent->children[index+1]==0) return;
-	BTreeNode child_a;
-	btree_node_read(disk, cache, parent->children[index], &child_a);
-	BTreeNode child_b;
-	btree_node_read(disk, cache, parent->children[index+1], &child_b);
-	child_a.right_sibling = child_b.right_sibling;
+	BTreeNode node;
+	btree_node_read(disk, cache, node_block, &node);
+	
+	int depth=0;
+	while (true) {
+		if (node.is_leaf) {
+			return depth;  // Reached a leaf, return current depth
+		}
+	
+		// Follow the leftmost child
+		if (node.children[0] != 0) {
+			btree_node_read(disk, cache, node.children[0], &node);
+			depth++;
+		} else {
+			printf("ERROR: Node is not leaf and child not found!!\n");
+			return -1;
+		}
+	}
+}
+
+/**
+ * Find the height of the B-tree from a given node
+ * Height is the number of levels from this node to the deepest leaf
+ */
+int btree_find_height(DiskInterface* disk, cache *cache, uint64_t node_block)
+{
+	BTreeNode node;
+	btree_node_read(disk, cache, node_block, &node);
+	
+	int height=0;
+	// Follow leftmost path to count levels; all leaves are at the same depth
+	while (!node.is_leaf && node.children[0] != 0)
+	{
+		btree_node_read(disk, cache, node.children[0], &node);
+		height++;
+	}
+	return height;
+}
+
+/**
+ * Find the minimum key in a B-tree subtree
+ * Follows the leftmost path to find the smallest key
+ */
+int btree_find_minimum(DiskInterface* disk, cache *cache, uint64_t root_block)
+{
+	BTreeNode node;
+	btree_node_read(disk, cache, root_block, &node);
 	
-	for (int i = MIN_KEYS + 1; i < MAX_KEYS; i++) {
-		child_a.keys[i] = child_b.keys[i - MIN_KEYS - 1];
-		child_a.num_keys++;
+	// Follow leftmost child until we reach a leaf
+	while (!node.is_leaf) {
+		if (node.children[0] == 0) return 0;  // Empty tree
+		btree_node_read(disk, cache, node.children[0], &node);
 	}
-	for (int i = MIN_KEYS + 1; i <= MAX_KEYS; i++) {
-		child_a.keys[i] = child_b.children[i - MIN_KEYS - 1];
+	return node.key;
+}
+
+/**
+ * Find the maximum key in a B-tree subtree
+ * Follows the rightmost path to find the largest key
+ */
+uint64_t btree_find_maximum(DiskInterface* disk, cache *cache, uint64_t root_block)
+{
+	BTreeNode node;
+	btree_node_read(disk, cache, root_block, &node);
+	
+	// Follow rightmost child until we reach a leaf
+	while (!node.is_leaf) {
+		if (node.children[node.num_keys] == 0) return 0;  // Empty tree
+		btree_node_read(disk, cache, node.children[node.num_keys], &node);
 	}
+	return node.key;
+}
+
+/**
+ * Count the keys below a key (or up to and including it) in one descent
+ * Every child left of the one the descent takes holds only smaller keys,
+ * so its whole count is added without visiting it
+ */
+static uint64_t btree_rank_at(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, bool inclusive)
+{
+	BTreeNode node;
+	uint64_t rank = 0;
+	uint64_t block = root_block;
 	
-	btree_node_write(disk, cache, &child_a);
+	while (block != 0) {
+		btree_node_read(disk, cache, block, &node);
+		if (node.is_leaf) {
+			if (node.key < key || (inclusive && node.key == key)) rank++;
+			break;
+		}
 	
-	for(int i=index+1; i<MAX_KEYS-1; i++)
-	{
-		parent->keys[i] = parent->keys[i+1];
+		int i = btree_child_index(&node, key);
+		for (int j = 0; j < i; j++) rank += node.counts[j];
+		block = node.children[i];
 	}
-	parent->keys[MAX_KEYS - 1] = 0;
+	return rank;
+}
+
+/**
+ * Number of keys in the tree smaller than key
+ */
+uint64_t btree_rank(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+{
+	return btree_rank_at(disk, cache, root_block, key, false);
+}
+
+/**
+ * Number of keys in [low, high]
+ */
+uint64_t btree_count_range(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t low, uint64_t high)
+{
+	if (low > high) return 0;
+	return btree_rank_at(disk, cache, root_block, high, true) - btree_rank_at(disk, cache, root_block, low, false);
+}
+
+/**
+ * Find the key with a given rank (0 for the smallest)
+ * Descends into the child whose count range covers the rank
+ */
+int btree_select(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t rank, uint64_t *key, uint64_t *value)
+{
+	BTreeNode node;
+	uint64_t block = root_block;
 	
-	for(int i=index+1; i<MAX_KEYS; i++)
-	{
-		parent->children[i] = parent->children[i+1];
+	while (block != 0) {
+		btree_node_read(disk, cache, block, &node);
+		if (node.is_leaf) {
+			if (rank != 0) return -1;
+			*key = node.key;
+			*value = node.value;
+			return 0;
+		}
+	
+		int i;
+		for (i = 0; i < node.num_keys && rank >= node.counts[i]; i++) rank -= node.counts[i];
+		block = node.children[i];
+	}
+	return -1;
+}
+
+/**
+ * Replace child slot index of an internal node by two children
+ * Everything under left is <= sep, everything under right is > sep.
+ * A full node overflows into its spare slot and must then be split.
+ */
+static void btree_node_split_slot(BTreeNode *node, int index, uint64_t sep, uint64_t left, uint64_t left_count, uint64_t right, uint64_t right_count)
+{
+	for (int i = node->num_keys; i > index; i--) {
+		node->keys[i] = node->keys[i - 1];
+		node->children[i + 1] = node->children[i];
+		node->counts[i + 1] = node->counts[i];
+	}
+	node->keys[index] = sep;
+	node->children[index] = left;
+	node->children[index + 1] = right;
+	node->counts[index] = left_count;
+	node->counts[index + 1] = right_count;
+	node->num_keys++;
+}
+
+/**
+ * Remove child slot index from an internal node
+ * The separator that went with the removed child is dropped with it
+ */
+static void btree_node_remove_slot(BTreeNode *node, int index)
+{
+	if (node->num_keys == 0) {
+		// Removing the only child leaves the node empty
+		node->children[0] = 0;
+		node->counts[0] = 0;
+		return;
 	}
 	
-	btree_node_free(disk, cache, &child_b);
+	// Drop the separator to the child's left (the first one for child 0), so
+	// the survivors' bounds still hold after a merge folds index into index-1
+	int key_index = (index > 0) ? index - 1 : 0;
+	for (int i = key_index; i < node->num_keys - 1; i++) {
+		node->keys[i] = node->keys[i + 1];
+	}
+	for (int i = index; i < node->num_keys; i++) {
+		node->children[i] = node->children[i + 1];
+		node->counts[i] = node->counts[i + 1];
+	}
+	node->keys[node->num_keys - 1] = 0;
+	node->children[node->num_keys] = 0;
+	node->counts[node->num_keys] = 0;
+	node->num_keys--;
+}
+
+/**
+ * Number of keys under a node
+ */
+static uint64_t btree_node_count(BTreeNode *node)
+{
+	if (node->is_leaf) return 1;
 	
-	parent->num_keys--;
+	uint64_t count = 0;
+	for (int i = 0; i <= node->num_keys; i++) count += node->counts[i];
+	return count;
+}
+
+/**
+ * Number of children the left half keeps when an overflowing node splits
+ * Nodes split evenly, except on the right edge of the tree: keys that only
+ * ever arrive in increasing order would leave every left half half-empty,
+ * so there the left half keeps BTREE_APPEND_SPLIT percent and the right
+ * half only what it needs to stay above the low-water mark
+ */
+static int btree_split_point(BTreeNode *node, bool append)
+{
+	int children = node->num_keys + 1;
+	if (!append) return (children + 1) / 2;
 	
-	if (parent->num_keys < MIN_KEYS) {
-		if (parent->parent == 0) {
-			if (parent->children[1]==0) {
-				printf("Promoting root!\n");
-				btree_promote_root(disk, cache, parent);
-			}
-		} else {
-			int rv = btree_borrow_left(disk, cache, parent);
-			if (rv==-1) {
-				rv = btree_borrow_right(disk, cache, parent);
-				if (rv==-1) {
-					BTreeNode grandparent;
-					btree_node_read(disk, cache, parent->parent, &grandparent);
-					int j;
-					for(j=0; j<MAX_KEYS && grandparent.keys[j] < btree_find_maximum(disk, cache, parent->block_number) && grandparent.keys[j]!=0; j++);
-					btree_merge_children(disk, cache, &grandparent, j);
-				}
+	int keep = children * BTREE_APPEND_SPLIT / 100;
+	if (keep > children - (BTREE_LOW_WATER + 1)) keep = children - (BTREE_LOW_WATER + 1);
+	if (keep < (children + 1) / 2) keep = (children + 1) / 2;
+	return keep;
+}
+
+/**
+ * Move the upper part of an overflowing node into a new right sibling
+ * @param keep Number of children left keeps
+ * @return Separator between the two halves
+ */
+static uint64_t btree_node_split(BTreeNode *left, BTreeNode *right, int keep)
+{
+	uint64_t sep = left->keys[keep - 1];
+	
+	right->num_keys = left->num_keys - keep;
+	for (int i = 0; i < right->num_keys; i++) {
+		right->keys[i] = left->keys[keep + i];
+	}
+	for (int i = 0; i <= right->num_keys; i++) {
+		right->children[i] = left->children[keep + i];
+		right->counts[i] = left->counts[keep + i];
+	}
+	
+	// Clear the moved slots
+	for (int i = keep - 1; i <= MAX_KEYS; i++) {
+		left->keys[i] = 0;
+	}
+	for (int i = keep; i <= MAX_KEYS + 1; i++) {
+		left->children[i] = 0;
+		left->counts[i] = 0;
+	}
+	left->num_keys = keep - 1;
+	return sep;
+}
+
+// Split the root keeping the given number of children on the left
+static void btree_split_root_at(DiskInterface* disk, cache *cache, BTreeNode* root, int keep)
+{
+	BTreeNode child_a = *btree_node_create(disk, cache, false);
+	BTreeNode child_b = *btree_node_create(disk, cache, false);
+	uint64_t block_a = child_a.block_number;
+	
+	// Left half is a copy of the root under a new block number
+	memcpy(&child_a, root, sizeof(struct BTreeNode));
+	child_a.block_number = block_a;
+	uint64_t sep = btree_node_split(&child_a, &child_b, keep);
+	
+	// Root now only points at the two halves
+	for (int i = 0; i <= MAX_KEYS; i++) root->keys[i] = 0;
+	for (int i = 0; i <= MAX_KEYS + 1; i++) root->children[i] = 0;
+	for (int i = 0; i <= MAX_KEYS + 1; i++) root->counts[i] = 0;
+	root->is_leaf = false;
+	root->num_keys = 1;
+	root->keys[0] = sep;
+	root->children[0] = child_a.block_number;
+	root->children[1] = child_b.block_number;
+	root->counts[0] = btree_node_count(&child_a);
+	root->counts[1] = btree_node_count(&child_b);
+	
+	btree_node_write(disk, cache, &child_a);
+	btree_node_write(disk, cache, &child_b);
+	btree_node_write(disk, cache, root);
+}
+
+// Split a child keeping the given number of children on the left
+static void btree_split_child_at(DiskInterface* disk, cache *cache, BTreeNode* node, int index, BTreeNode* child, int keep)
+{
+	BTreeNode child_b = *btree_node_create(disk, cache, false);
+	
+	uint64_t sep = btree_node_split(child, &child_b, keep);
+	btree_node_split_slot(node, index, sep, child->block_number, btree_node_count(child), child_b.block_number, btree_node_count(&child_b));
+	btree_buffer_move(disk, cache, child->block_number, child_b.block_number, sep + 1, UINT64_MAX);
+	
+	btree_node_write(disk, cache, child);
+	btree_node_write(disk, cache, &child_b);
+}
+
+/**
+ * Split the root node when it overflows
+ * The root keeps its block number: its contents move into two new children
+ * and the root becomes their parent. Grandchildren are not touched.
+ */
+void btree_split_root(DiskInterface* disk, cache *cache, BTreeNode* root)
+{
+	btree_split_root_at(disk, cache, root, btree_split_point(root, false));
+}
+
+/**
+ * Split an overflowing child node
+ * The upper half of child moves into a new node linked in after it in node.
+ * Writes the two halves; node is only updated in memory since it may
+ * overflow in turn.
+ */
+void btree_split_child(DiskInterface* disk, cache *cache, BTreeNode* node, int index, BTreeNode* child)
+{
+	btree_split_child_at(disk, cache, node, index, child, btree_split_point(child, false));
+}
+
+/**
+ * Write back the internal node at path level d after it gained a child
+ * An overflowing node is split and the split carried up the path, so each
+ * level costs the node, its new sibling and the parent. path is kept
+ * pointing at the slot path->index[d] refers to through the splits.
+ * @param append The new entry is the rightmost in the tree
+ */
+static void btree_insert_fixup(DiskInterface* disk, cache *cache, BTreePath *path, int d, BTreeNode *node, bool append)
+{
+	while (node->num_keys > MAX_KEYS) {
+		int keep = btree_split_point(node, append);
+		btree_route_touch(cache, path->blocks[0], (d > 0) ? d - 1 : 0);
+		if (d == 0) {
+			btree_split_root_at(disk, cache, node, keep);
+			
+			// The root's contents moved down a level
+			for (int i = path->depth; i > 0; i--) {
+				path->blocks[i] = path->blocks[i - 1];
+				path->index[i] = path->index[i - 1];
 			}
+			path->depth++;
+			path->index[0] = (path->index[1] >= keep) ? 1 : 0;
+			path->blocks[1] = node->children[path->index[0]];
+			if (path->index[0] == 1) path->index[1] -= keep;
+			return;
+		}
+		BTreeNode parent;
+		btree_node_read(disk, cache, path->blocks[d - 1], &parent);
+		btree_split_child_at(disk, cache, &parent, path->index[d - 1], node, keep);
+		
+		// Follow the slot into the new right half if that's where it went
+		if (path->index[d] >= keep) {
+			path->index[d - 1]++;
+			path->blocks[d] = parent.children[path->index[d - 1]];
+			path->index[d] -= keep;
 		}
+		*node = parent;
+		d--;
 	}
+	btree_node_write(disk, cache, node);
+}
+
+/**
+ * Where the last insert into a tree went, kept while that was the
+ * rightmost leaf so the next larger key can be appended without a descent
+ */
+typedef struct btree_hint_t
+{
+	cache *cache;
+	uint64_t root_block;
+	uint64_t leaf_block;         // Rightmost leaf (0 if the hint is invalid)
+	uint64_t key;                // Key held by that leaf
+	BTreePath path;              // Path to it; index[depth-1] is its slot
+} btree_hint_t;
+
+static btree_hint_t btree_hints[BTREE_HINTS];
+
+static btree_hint_t *btree_hint(cache *cache, uint64_t root_block)
+{
+	btree_hint_t *hint = &btree_hints[root_block % BTREE_HINTS];
+	if (hint->cache != cache || hint->root_block != root_block) return NULL;
+	return hint->leaf_block ? hint : NULL;
+}
+
+// Forget the rightmost leaf of a tree whose shape changed under the hint, freeing its slot
+static void btree_hint_clear(cache *cache, uint64_t root_block)
+{
+	btree_hint_t *hint = btree_hint(cache, root_block);
+	if (hint) hint->leaf_block = 0;
+}
+
+/**
+ * Link a new leaf into the leaf chain between two neighbours (0 for none)
+ */
+static void btree_link_leaf(DiskInterface* disk, cache *cache, BTreeNode *leaf, uint64_t left_block, uint64_t right_block)
+{
+	BTreeNode neighbour;
+	leaf->left_sibling = left_block;
+	leaf->right_sibling = right_block;
+	if (left_block != 0) {
+		btree_node_read(disk, cache, left_block, &neighbour);
+		neighbour.right_sibling = leaf->block_number;
+		btree_node_write(disk, cache, &neighbour);
+	}
+	if (right_block != 0) {
+		btree_node_read(disk, cache, right_block, &neighbour);
+		neighbour.left_sibling = leaf->block_number;
+		btree_node_write(disk, cache, &neighbour);
+	}
+}
+
+/**
+ * Add delta to the key count of the child taken at each of the first
+ * levels of path
+ * Only the count is dirtied, so ancestors that don't split cost 8 bytes
+ */
+static void btree_path_count(DiskInterface* disk, cache *cache, BTreePath *path, int levels, int64_t delta)
+{
+	for (int d = 0; d < levels; d++) {
+		BTreeNode node;
+		btree_node_read(disk, cache, path->blocks[d], &node);
+		uint64_t count = node.counts[path->index[d]] + delta;
+		write_block_range(disk, cache, &count, 0, path->blocks[d], 1 + offsetof(struct BTreeNode, counts) + path->index[d] * sizeof(uint64_t), sizeof(uint64_t));
+	}
+}
+
+/**
+ * Find the leaf a key belongs next to for an insert
+ * A key larger than everything in the tree goes straight to the rightmost
+ * leaf remembered from the previous insert, without a descent.
+ * @param leaf Filled with the leaf found
+ * @return Block number of the leaf, or 0 if the tree is empty
+ */
+static uint64_t btree_insert_find(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, BTreePath *path, BTreeNode *leaf)
+{
+	btree_hint_t *hint = btree_hint(cache, root_block);
+	if (hint && key > hint->key) {
+		// Appending past the rightmost leaf - check the hint still matches the tree
+		BTreeNode parent;
+		*path = hint->path;
+		btree_node_read(disk, cache, path->blocks[path->depth - 1], &parent);
+		btree_node_read(disk, cache, hint->leaf_block, leaf);
+		if (parent.children[path->index[path->depth - 1]] == hint->leaf_block && leaf->right_sibling == 0)
+			return hint->leaf_block;
+	}
+	
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, key, path);
+	if (leaf_block != 0) btree_node_read(disk, cache, leaf_block, leaf);
+	return leaf_block;
+}
+
+/**
+ * Add a leaf for a key that isn't in the tree next to the leaf found by
+ * btree_insert_find, then split overflowing nodes bottom-up along the path.
+ * A split writes the node, its new sibling and the parent; the children
+ * that move are not rewritten.
+ * @return Block number of the new leaf
+ */
+static uint64_t btree_insert_leaf(DiskInterface* disk, cache *cache, uint64_t root_block, BTreePath *path, uint64_t leaf_block, BTreeNode *sibling, uint64_t key, uint64_t value)
+{
+	BTreeNode parent;
+	BTreeNode node = *btree_node_create(disk, cache, true);
+	node.key = key;
+	node.value = value;
+	
+	if (leaf_block == 0) {
+		// First key of an empty tree
+		BTreeNode root;
+		btree_node_read(disk, cache, root_block, &root);
+		root.children[0] = node.block_number;
+		root.counts[0] = 1;
+		btree_node_write(disk, cache, &node);
+		btree_node_write(disk, cache, &root);
+		btree_route_touch(cache, root_block, 0);
+		btree_filter_add(disk, cache, root_block, key);
+		return node.block_number;
+	}
+	
+	// The leaf the descent ended on becomes the new leaf's neighbour
+	btree_path_count(disk, cache, path, path->depth - 1, 1);
+	btree_route_touch(cache, root_block, path->depth - 1);
+	btree_node_read(disk, cache, path->blocks[path->depth - 1], &parent);
+	int index = path->index[path->depth - 1];
+	
+	// The separator is the smaller of the two keys as it is. Separators are
+	// fixed 64-bit integers, so a shorter one would save no space in the node.
+	if (key < sibling->key) {
+		btree_node_split_slot(&parent, index, key, node.block_number, 1, sibling->block_number, 1);
+		btree_link_leaf(disk, cache, &node, sibling->left_sibling, sibling->block_number);
+	} else {
+		btree_node_split_slot(&parent, index, sibling->key, sibling->block_number, 1, node.block_number, 1);
+		btree_link_leaf(disk, cache, &node, sibling->block_number, sibling->right_sibling);
+		path->index[path->depth - 1]++;
+	}
+	
+	printf("Placing node with key %lu in block %lu\n", key, parent.block_number);
+	btree_node_write(disk, cache, &node);
+	btree_filter_add(disk, cache, root_block, key);
+	bool append = (node.right_sibling == 0);
+	btree_insert_fixup(disk, cache, path, path->depth - 1, &parent, append);
+	
+	// Remember the new rightmost leaf, or drop a hint the splits may have invalidated.
+	// A slot holding another tree's hint is left alone; this tree goes without one.
+	btree_hint_t *hint = &btree_hints[root_block % BTREE_HINTS];
+	bool owned = (hint->cache == cache && hint->root_block == root_block);
+	if (append && (owned || hint->leaf_block == 0)) {
+		hint->cache = cache;
+		hint->root_block = root_block;
+		hint->leaf_block = node.block_number;
+		hint->key = key;
+		hint->path = *path;
+	} else if (owned) {
+		hint->leaf_block = 0;
+	}
+	return node.block_number;
+}
+
+/**
+ * Overwrite the value of a leaf in its cached block
+ * Only the value bytes are dirtied; the leaf's links and key are untouched
+ */
+static void btree_leaf_set_value(DiskInterface* disk, cache *cache, uint64_t leaf_block, uint64_t value)
+{
+	write_block_range(disk, cache, &value, 0, leaf_block, 1 + offsetof(struct BTreeNode, value), sizeof(uint64_t));
+}
+
+/**
+ * Insert a key into the B-tree
+ * Descends once, remembering the path, then splits overflowing nodes
+ * bottom-up along that path.
+ */
+int btree_insert(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	MemTable *memtable = btree_memtable(cache, root_block);
+	if (memtable) {
+		// Whether the tree already has the key is settled when the insert is flushed
+		int rv = memtable_insert(memtable, key, value);
+		if (rv == -1) {
+			btree_memtable_flush(disk, cache, root_block);
+			rv = memtable_insert(memtable, key, value);
+		}
+		if (rv == 1) {
+			printf("Key %lu already exists!\n", key);
+			return -1;
+		}
+		return 0;
+	}
+	
+	uint64_t leaf_block = btree_insert_find(disk, cache, root_block, key, &path, &leaf);
+	if (leaf_block != 0 && leaf.key == key) {
+		printf("Key %lu already exists!\n", key);
+		return -1;
+	}
+	
+	btree_insert_leaf(disk, cache, root_block, &path, leaf_block, &leaf, key, value);
+	return 0;
+}
+
+/**
+ * Set the value of a key, inserting it if it isn't in the tree
+ * An existing key is updated in place after a single descent
+ */
+int btree_upsert(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	MemTable *memtable = btree_memtable(cache, root_block);
+	if (memtable) {
+		uint64_t old;
+		bool found = btree_memtable_lookup(disk, cache, root_block, memtable, key, &old);
+		btree_memtable_put(disk, cache, root_block, memtable, key, value, false);
+		return found ? 1 : 0;
+	}
+	
+	uint64_t leaf_block = btree_insert_find(disk, cache, root_block, key, &path, &leaf);
+	if (leaf_block != 0 && leaf.key == key) {
+		btree_leaf_set_value(disk, cache, leaf_block, value);
+		return 1;
+	}
+	
+	btree_insert_leaf(disk, cache, root_block, &path, leaf_block, &leaf, key, value);
+	return 0;
+}
+
+/**
+ * Read-modify-write the value of a key in a single descent
+ * fn sees the current value (or 0 if the key is absent) and returns
+ * whether to store what it left in value; an absent key is inserted then.
+ */
+int btree_update(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, btree_update_fn fn, void *ctx)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	MemTable *memtable = btree_memtable(cache, root_block);
+	if (memtable) {
+		uint64_t value = 0;
+		bool found = btree_memtable_lookup(disk, cache, root_block, memtable, key, &value);
+		if (!found) value = 0;
+		if (fn(key, &value, found, ctx)) btree_memtable_put(disk, cache, root_block, memtable, key, value, false);
+		return found ? 1 : 0;
+	}
+	
+	uint64_t leaf_block = btree_insert_find(disk, cache, root_block, key, &path, &leaf);
+	bool found = (leaf_block != 0 && leaf.key == key);
+	uint64_t value = found ? leaf.value : 0;
+	
+	if (!fn(key, &value, found, ctx)) return found ? 1 : 0;
+	
+	if (found) {
+		if (value != leaf.value) btree_leaf_set_value(disk, cache, leaf_block, value);
+		return 1;
+	}
+	btree_insert_leaf(disk, cache, root_block, &path, leaf_block, &leaf, key, value);
+	return 0;
+}
+
+// Apply a single message to the leaves with a descent from the root
+static void btree_buffer_apply(DiskInterface* disk, cache *cache, uint64_t root_block, btree_message_t *message)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	if (message->op == BTREE_MSG_DELETE) {
+		btree_delete(disk, cache, root_block, message->key);
+		return;
+	}
+	
+	uint64_t leaf_block = btree_insert_find(disk, cache, root_block, message->key, &path, &leaf);
+	if (leaf_block != 0 && leaf.key == message->key) {
+		if (message->op == BTREE_MSG_UPSERT) btree_leaf_set_value(disk, cache, leaf_block, message->value);
+		return;
+	}
+	btree_insert_leaf(disk, cache, root_block, &path, leaf_block, &leaf, message->key, message->value);
+}
+
+// Leaf holding the current value of a key in a tree with a memtable, or 0 if
+// the key is absent. A value only the memtable has is written through to the
+// tree for this key alone; its entry stays, and the flush finds nothing to change.
+static uint64_t btree_memtable_leaf(DiskInterface* disk, cache *cache, uint64_t root_block, MemTable *memtable, uint64_t key)
+{
+	BTreeNode leaf;
+	uint64_t value;
+	int buffered = memtable_get(memtable, key, &value);
+	if (buffered == 0) return 0;
+	
+	uint64_t leaf_block = btree_find_leaf(disk, cache, root_block, key, &leaf);
+	if (buffered == -1 || (leaf_block != 0 && (buffered == 2 || leaf.value == value))) return leaf_block;
+	
+	btree_message_t message = { .key = key, .value = value, .op = (buffered == 2) ? BTREE_MSG_INSERT : BTREE_MSG_UPSERT };
+	btree_buffer_apply(disk, cache, root_block, &message);
+	return btree_find_leaf(disk, cache, root_block, key, &leaf);
+}
+
+/**
+ * Search for a key in the B-tree
+ * Follows the separators from the root down to the one leaf that can hold the key.
+ * A tree with a Bloom filter skips the descent for most absent keys. In a
+ * tree with a memtable, deleted keys are answered from it, and a key whose
+ * current value only the memtable has is written through to get a leaf to return.
+ */
+uint64_t btree_search(DiskInterface* disk, cache *cache, uint64_t node_block, uint64_t key)
+{
+	BTreeNode leaf;
+	MemTable *memtable = btree_memtable(cache, node_block);
+	uint64_t leaf_block = memtable ? btree_memtable_leaf(disk, cache, node_block, memtable, key) : btree_find_leaf(disk, cache, node_block, key, &leaf);
+	
+	if (leaf_block != 0) {
+		printf("Found key!\n");
+		return leaf_block;
+	}
+	printf("Did not find key!\n");
+	return -1;
+}
+
+/**
+ * Children of an internal node while it may hold more than MAX_KEYS + 1
+ * keys[i] separates children[i] from children[i+1], as in a node.
+ */
+typedef struct btree_run_t
+{
+	int n;                       // Number of children
+	uint64_t keys[BTREE_RUN_MAX];
+	uint64_t children[BTREE_RUN_MAX];
+	uint64_t counts[BTREE_RUN_MAX];
+} btree_run_t;
+
+// Make children [first, first+n) of a run the only children of a node
+static void btree_run_fill(BTreeNode *node, btree_run_t *run, int first, int n)
+{
+	for (int i = 0; i <= MAX_KEYS; i++) node->keys[i] = 0;
+	for (int i = 0; i <= MAX_KEYS + 1; i++) node->children[i] = 0;
+	for (int i = 0; i <= MAX_KEYS + 1; i++) node->counts[i] = 0;
+	node->num_keys = n - 1;
+	for (int i = 0; i < n - 1; i++) node->keys[i] = run->keys[first + i];
+	for (int i = 0; i < n; i++) {
+		node->children[i] = run->children[first + i];
+		node->counts[i] = run->counts[first + i];
+	}
+}
+
+// Cut a run into as few nodes as hold it; chunks gets one child per node
+static void btree_run_chunk(btree_run_t *run, btree_run_t *chunks)
+{
+	chunks->n = (run->n + MAX_KEYS) / (MAX_KEYS + 1);
+	for (int j = 0; j < chunks->n; j++) {
+		int first = j * run->n / chunks->n;
+		int last = (j + 1) * run->n / chunks->n;
+		if (j > 0) chunks->keys[j - 1] = run->keys[first - 1];
+		chunks->counts[j] = 0;
+		for (int i = first; i < last; i++) chunks->counts[j] += run->counts[i];
+	}
+}
+
+/**
+ * Put a run of children in place of child slot index of the internal node
+ * at path level d
+ * A node that overflows is split as many ways as it takes, and the pieces
+ * replace it in its parent in turn; the root keeps its block and adds
+ * levels until its children fit. Ancestors that don't split only have the
+ * count of the child taken updated.
+ */
+static void btree_replace_slot(DiskInterface* disk, cache *cache, BTreePath *path, int d, int index, btree_run_t *run)
+{
+	BTreeNode node;
+	btree_run_t wide;
+	btree_run_t chunks;
+	
+	while (true) {
+		btree_node_read(disk, cache, path->blocks[d], &node);
+		btree_route_touch(cache, path->blocks[0], d);
+		
+		// Splice the run into the node's children
+		int64_t delta = -(int64_t)node.counts[index];
+		wide.n = 0;
+		for (int i = 0; i <= node.num_keys; i++) {
+			if (i != index) {
+				wide.children[wide.n] = node.children[i];
+				wide.counts[wide.n++] = node.counts[i];
+			} else {
+				for (int j = 0; j < run->n; j++) {
+					if (j > 0) wide.keys[wide.n - 1] = run->keys[j - 1];
+					wide.children[wide.n] = run->children[j];
+					wide.counts[wide.n++] = run->counts[j];
+					delta += run->counts[j];
+				}
+			}
+			if (i < node.num_keys) wide.keys[wide.n - 1] = node.keys[i];
+		}
+		
+		// The root's children move down a level into new nodes until they fit
+		while (d == 0 && wide.n > MAX_KEYS + 1) {
+			btree_run_chunk(&wide, &chunks);
+			int first = 0;
+			for (int j = 0; j < chunks.n; j++) {
+				BTreeNode child = *btree_node_create(disk, cache, false);
+				int n = (j + 1) * wide.n / chunks.n - first;
+				btree_run_fill(&child, &wide, first, n);
+				btree_node_write(disk, cache, &child);
+				chunks.children[j] = child.block_number;
+				first += n;
+			}
+			wide = chunks;
+		}
+		
+		if (wide.n <= MAX_KEYS + 1) {
+			btree_run_fill(&node, &wide, 0, wide.n);
+			btree_node_write(disk, cache, &node);
+			if (delta != 0) btree_path_count(disk, cache, path, d, delta);
+			return;
+		}
+		
+		// The node keeps the first piece; later pieces take their messages along
+		btree_run_chunk(&wide, &chunks);
+		for (int j = chunks.n - 1; j >= 0; j--) {
+			int first = j * wide.n / chunks.n;
+			int n = (j + 1) * wide.n / chunks.n - first;
+			BTreeNode piece = node;
+			if (j > 0) {
+				piece = *btree_node_create(disk, cache, false);
+				btree_buffer_move(disk, cache, node.block_number, piece.block_number, chunks.keys[j - 1] + 1, UINT64_MAX);
+			}
+			btree_run_fill(&piece, &wide, first, n);
+			btree_node_write(disk, cache, &piece);
+			chunks.children[j] = piece.block_number;
+		}
+		
+		*run = chunks;
+		d--;
+		index = path->index[d];
+	}
+}
+
+// Order messages by key, keeping the arrival order of each key's messages
+static int btree_message_cmp(const void *a, const void *b)
+{
+	const btree_message_t *ma = *(btree_message_t * const *)a;
+	const btree_message_t *mb = *(btree_message_t * const *)b;
+	if (ma->key != mb->key) return (ma->key > mb->key) - (ma->key < mb->key);
+	return (ma > mb) - (ma < mb);
+}
+
+/**
+ * Apply a batch of messages for one child slot of a bottom-level node in
+ * a single pass
+ * The final state of every key is worked out from the leaf in the slot and
+ * the messages first. The leaf then keeps one of the surviving keys, and
+ * leaves for the others are linked in around it and replace the slot in
+ * one splice, so ancestors are read and written once per batch.
+ */
+static void btree_buffer_apply_batch(DiskInterface* disk, cache *cache, uint64_t root_block, btree_buffer_t *batch)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	btree_message_t *sorted[BTREE_BUFFER_CAPACITY];
+	uint64_t keys[BTREE_BUFFER_CAPACITY + 1];
+	uint64_t values[BTREE_BUFFER_CAPACITY + 1];
+	
+	// Every message of the batch routes to the same slot
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, batch->messages[0].key, &path);
+	if (leaf_block != 0) btree_node_read(disk, cache, leaf_block, &leaf);
+	
+	for (int i = 0; i < batch->count; i++) sorted[i] = &batch->messages[i];
+	qsort(sorted, batch->count, sizeof(btree_message_t*), btree_message_cmp);
+	
+	// Replay each key's messages over what the leaf holds
+	int n = 0;
+	int kept = -1;               // Entry the leaf's own key ended up in
+	bool pending = (leaf_block != 0);
+	for (int i = 0; i < batch->count; ) {
+		uint64_t key = sorted[i]->key;
+		if (pending && leaf.key < key) {
+			kept = n;
+			keys[n] = leaf.key;
+			values[n++] = leaf.value;
+			pending = false;
+		}
+		
+		bool found = (pending && leaf.key == key);
+		uint64_t value = found ? leaf.value : 0;
+		if (found) pending = false;
+		for (; i < batch->count && sorted[i]->key == key; i++) {
+			if (sorted[i]->op == BTREE_MSG_DELETE) {
+				found = false;
+			} else if (sorted[i]->op == BTREE_MSG_UPSERT || !found) {
+				found = true;
+				value = sorted[i]->value;
+			}
+		}
+		if (!found) continue;
+		if (leaf_block != 0 && key == leaf.key) kept = n;
+		keys[n] = key;
+		values[n++] = value;
+	}
+	if (pending) {
+		kept = n;
+		keys[n] = leaf.key;
+		values[n++] = leaf.value;
+	}
+	
+	if (n == 0) {
+		// Every key is gone, the leaf's included
+		if (leaf_block != 0) btree_delete(disk, cache, root_block, leaf.key);
+		return;
+	}
+	
+	// The leaf holds its own key if that survived, or else the first key
+	int reuse = -1;
+	if (leaf_block != 0) {
+		reuse = (kept >= 0) ? kept : 0;
+		if (kept < 0) btree_filter_remove(cache, root_block);
+		if (n == 1 && kept == 0) {
+			if (values[0] != leaf.value) btree_leaf_set_value(disk, cache, leaf_block, values[0]);
+			return;
+		}
+	}
+	
+	btree_run_t run;
+	uint64_t left = (leaf_block != 0) ? leaf.left_sibling : 0;
+	uint64_t right = (leaf_block != 0) ? leaf.right_sibling : 0;
+	BTreeNode node;
+	run.n = n;
+	for (int i = 0; i < n; i++) {
+		if (i == reuse) {
+			run.children[i] = leaf_block;
+		} else {
+			run.children[i] = btree_node_create(disk, cache, true)->block_number;
+			btree_filter_add(disk, cache, root_block, keys[i]);
+		}
+		run.counts[i] = 1;
+		if (i < n - 1) run.keys[i] = keys[i];
+	}
+	if (leaf_block != 0 && kept < 0) btree_filter_add(disk, cache, root_block, keys[reuse]);
+	
+	// Chain the run's leaves together between the old leaf's neighbours
+	for (int i = 0; i < n; i++) {
+		btree_node_read(disk, cache, run.children[i], &node);
+		node.key = keys[i];
+		node.value = values[i];
+		node.left_sibling = (i > 0) ? run.children[i - 1] : left;
+		node.right_sibling = (i < n - 1) ? run.children[i + 1] : right;
+		btree_node_write(disk, cache, &node);
+	}
+	if (left != 0 && run.children[0] != leaf_block) {
+		btree_node_read(disk, cache, left, &node);
+		node.right_sibling = run.children[0];
+		btree_node_write(disk, cache, &node);
+	}
+	if (right != 0 && run.children[n - 1] != leaf_block) {
+		btree_node_read(disk, cache, right, &node);
+		node.left_sibling = run.children[n - 1];
+		btree_node_write(disk, cache, &node);
+	}
+	
+	btree_hint_clear(cache, root_block);
+	btree_replace_slot(disk, cache, &path, path.depth - 1, path.index[path.depth - 1], &run);
+}
+
+/**
+ * Flush one batch out of an internal node's buffer
+ * The batch is every message for the child with the most of them. If the
+ * child is internal the batch joins its buffer, after flushing the child
+ * first when there isn't room; at the bottom level it is applied to the
+ * leaves. Applying can restructure the tree around block, so the node is
+ * not looked at again afterwards.
+ */
+static void btree_buffer_flush(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t block)
+{
+	BTreeNode node;
+	btree_buffer_t buffer;
+	btree_buffer_t batch;
+	btree_node_read(disk, cache, block, &node);
+	btree_buffer_read(disk, cache, block, &buffer);
+	if (buffer.count == 0) return;
+	
+	// Pick the child with the most pending messages
+	int pending[MAX_KEYS + 2] = {0};
+	int best = 0;
+	for (int i = 0; i < buffer.count; i++) pending[btree_child_index(&node, buffer.messages[i].key)]++;
+	for (int i = 1; i <= node.num_keys; i++) {
+		if (pending[i] > pending[best]) best = i;
+	}
+	
+	// Only an empty root has no child; its messages go straight to the leaf level
+	uint64_t child_block = node.children[best];
+	bool bottom = true;
+	if (child_block != 0) {
+		BTreeNode child;
+		btree_node_read(disk, cache, child_block, &child);
+		bottom = child.is_leaf;
+	}
+	if (!bottom && (size_t)(btree_buffer_count(disk, cache, child_block) + pending[best]) > BTREE_BUFFER_CAPACITY) {
+		btree_buffer_flush(disk, cache, root_block, child_block);
+		return;
+	}
+	
+	int kept = 0;
+	batch.count = 0;
+	for (int i = 0; i < buffer.count; i++) {
+		btree_message_t *message = &buffer.messages[i];
+		if (btree_child_index(&node, message->key) == best) batch.messages[batch.count++] = *message;
+		else buffer.messages[kept++] = *message;
+	}
+	buffer.count = kept;
+	btree_buffer_write(disk, cache, block, &buffer);
+	
+	if (!bottom) {
+		btree_buffer_push(disk, cache, child_block, batch.messages, batch.count);
+		return;
+	}
+	btree_buffer_apply_batch(disk, cache, root_block, &batch);
+}
+
+// Queue a message at the root, flushing batches down while the root buffer is full
+static void btree_buffer_send(DiskInterface* disk, cache *cache, uint64_t root_block, uint8_t op, uint64_t key, uint64_t value)
+{
+	btree_message_t message = { .key = key, .value = value, .op = op };
+	
+	btree_buffer_push(disk, cache, root_block, &message, 1);
+	while (btree_buffer_count(disk, cache, root_block) >= BTREE_BUFFER_CAPACITY) {
+		btree_buffer_flush(disk, cache, root_block, root_block);
+	}
+}
+
+/**
+ * Insert a key into a buffered tree unless it is already there
+ * Only the root block is written; whether the key existed is only known
+ * once the message reaches the leaves.
+ */
+void btree_insert_buffered(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value)
+{
+	btree_buffer_send(disk, cache, root_block, BTREE_MSG_INSERT, key, value);
+}
+
+/**
+ * Set the value of a key in a buffered tree, inserting it if absent
+ */
+void btree_upsert_buffered(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value)
+{
+	btree_buffer_send(disk, cache, root_block, BTREE_MSG_UPSERT, key, value);
+}
+
+/**
+ * Delete a key from a buffered tree if it is there
+ */
+void btree_delete_buffered(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+{
+	btree_buffer_send(disk, cache, root_block, BTREE_MSG_DELETE, key, 0);
+}
+
+/**
+ * Look up a key in a buffered tree
+ * The leaf's value is replayed through the messages for the key pending
+ * on the path above it, oldest (lowest) first. A memtable in front of the
+ * tree is looked at before any of them.
+ */
+int btree_get(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t *value)
+{
+	BTreePath path;
+	bool found = false;
+	uint64_t result = 0;
+	
+	MemTable *memtable = btree_memtable(cache, root_block);
+	uint64_t pending;
+	int buffered = memtable ? memtable_get(memtable, key, &pending) : -1;
+	if (buffered == 0) return -1;
+	if (buffered == 1) {
+		*value = pending;
+		return 0;
+	}
+	
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, key, &path);
+	if (leaf_block != 0) {
+		BTreeNode leaf;
+		btree_node_read(disk, cache, leaf_block, &leaf);
+		found = (leaf.key == key);
+		result = leaf.value;
+	}
+	
+	for (int d = path.depth - 1; d >= 0; d--) {
+		btree_buffer_t *buffer = btree_buffer(get_block(disk, cache, 0, path.blocks[d]));
+		for (int i = 0; i < buffer->count; i++) {
+			btree_message_t *message = &buffer->messages[i];
+			if (message->key != key) continue;
+			
+			if (message->op == BTREE_MSG_DELETE) {
+				found = false;
+			} else if (message->op == BTREE_MSG_UPSERT || !found) {
+				found = true;
+				result = message->value;
+			}
+		}
+	}
+	
+	// A pending insert only holds the value if the tree doesn't have the key
+	if (!found && buffered == 2) {
+		found = true;
+		result = pending;
+	}
+	if (!found) return -1;
+	*value = result;
+	return 0;
+}
+
+// First internal node in preorder with pending messages, or 0
+static uint64_t btree_buffer_find_pending(DiskInterface* disk, cache *cache, uint64_t block)
+{
+	BTreeNode node;
+	btree_node_read(disk, cache, block, &node);
+	if (node.is_leaf) return 0;
+	if (btree_buffer_count(disk, cache, block) > 0) return block;
+	
+	for (int i = 0; i <= node.num_keys && node.children[i] != 0; i++) {
+		uint64_t pending = btree_buffer_find_pending(disk, cache, node.children[i]);
+		if (pending != 0) return pending;
+	}
+	return 0;
+}
+
+/**
+ * Apply every pending message of a buffered tree to its leaves
+ * Afterwards the tree can be used with the unbuffered operations again.
+ */
+void btree_buffer_drain(DiskInterface* disk, cache *cache, uint64_t root_block)
+{
+	uint64_t block;
+	while ((block = btree_buffer_find_pending(disk, cache, root_block)) != 0) {
+		btree_buffer_flush(disk, cache, root_block, block);
+	}
+}
+
+/**
+ * Keep the writes to a tree in a memtable of the given number of keys
+ * A tree that already has one has it flushed and replaced.
+ */
+void btree_memtable_enable(DiskInterface* disk, cache *cache, uint64_t root_block, uint32_t entries)
+{
+	btree_memtable_disable(disk, cache, root_block);
+	
+	btree_memtable_t *slot = malloc(sizeof(btree_memtable_t));
+	slot->next = btree_memtables[root_block % BTREE_MEMTABLES];
+	btree_memtables[root_block % BTREE_MEMTABLES] = slot;
+	slot->cache = cache;
+	slot->root_block = root_block;
+	slot->memtable = memtable_create(entries);
+}
+
+/**
+ * Flush a tree's memtable and go back to writing the tree directly
+ */
+void btree_memtable_disable(DiskInterface* disk, cache *cache, uint64_t root_block)
+{
+	if (!btree_memtable(cache, root_block)) return;
+	
+	btree_memtable_flush(disk, cache, root_block);
+	btree_memtable_t **link = &btree_memtables[root_block % BTREE_MEMTABLES];
+	while (*link && ((*link)->cache != cache || (*link)->root_block != root_block)) link = &(*link)->next;
+	btree_memtable_t *slot = *link;
+	
+	*link = slot->next;
+	memtable_free(slot->memtable);
+	free(slot);
+}
+
+/**
+ * Apply a tree's memtable to the tree in key order
+ * Consecutive keys share most of their path, so the descents find their
+ * nodes in the cache and a run of keys under one parent dirties it in a
+ * single burst instead of once per random write.
+ */
+void btree_memtable_flush(DiskInterface* disk, cache *cache, uint64_t root_block)
+{
+	btree_memtable_t *slot = btree_memtable_slot(cache, root_block);
+	if (!slot || !slot->memtable) return;
+	
+	// Detach the table so the writes below go to the tree itself
+	MemTable *memtable = slot->memtable;
+	slot->memtable = NULL;
+	for (uint32_t i = memtable->head[0]; i != MEMTABLE_NIL; i = memtable->entries[i].next[0]) {
+		MemTable_Entry *entry = &memtable->entries[i];
+		btree_message_t message = { .key = entry->key, .value = entry->value, .op = entry->deleted ? BTREE_MSG_DELETE : entry->if_absent ? BTREE_MSG_INSERT : BTREE_MSG_UPSERT };
+		btree_buffer_apply(disk, cache, root_block, &message);
+	}
+	memtable_clear(memtable);
+	slot->memtable = memtable;
+}
+
+/**
+ * Slotted page holding the byte-string keys of a leaf
+ * It takes the rest of the leaf block after the node: a slot array grows
+ * up from the header and the key bytes grow down from the end of the block
+ */
+typedef struct btree_slot_t
+{
+	uint64_t value;              // Value stored with the key
+	uint16_t offset;             // Position of the key bytes in the block
+	uint16_t len;                // Length of the key
+} btree_slot_t;
+
+typedef struct btree_slot_page_t
+{
+	uint16_t count;              // Number of keys
+	uint16_t data_start;         // Lowest byte used by key data
+	btree_slot_t slots[];
+} btree_slot_page_t;
+
+#define BTREE_SLOT_PAGE_OFFSET BTREE_NODE_END
+
+static btree_slot_page_t *btree_slot_page(void *block)
+{
+	return (btree_slot_page_t*)((char*)block + BTREE_SLOT_PAGE_OFFSET);
+}
+
+// Index of a key in the page, or -1
+static int btree_slot_find(void *block, const void *key, uint16_t len)
+{
+	btree_slot_page_t *page = btree_slot_page(block);
+	for (int i = 0; i < page->count; i++) {
+		if (page->slots[i].len == len && memcmp((char*)block + page->slots[i].offset, key, len) == 0) return i;
+	}
+	return -1;
+}
+
+/**
+ * Add a key to the slotted page of a resident leaf block
+ * @return 0 on success, -1 if the page is full
+ */
+static int btree_slot_add(DiskInterface* disk, cache *cache, uint64_t leaf_block, const void *key, uint16_t len, uint64_t value)
+{
+	void *block = get_block(disk, cache, 0, leaf_block);
+	btree_slot_page_t *page = btree_slot_page(block);
+	uint32_t slots_end = BTREE_SLOT_PAGE_OFFSET + sizeof(btree_slot_page_t) + (page->count + 1) * sizeof(btree_slot_t);
+	if (slots_end + len > page->data_start) return -1;
+	
+	page->data_start -= len;
+	memcpy((char*)block + page->data_start, key, len);
+	page->slots[page->count].value = value;
+	page->slots[page->count].offset = page->data_start;
+	page->slots[page->count].len = len;
+	page->count++;
+	
+	cache_mark_dirty(disk, cache, leaf_block, BTREE_SLOT_PAGE_OFFSET, slots_end - BTREE_SLOT_PAGE_OFFSET);
+	cache_mark_dirty(disk, cache, leaf_block, page->data_start, len);
+	return 0;
+}
+
+/**
+ * Remove slot index from the slotted page of a resident leaf block
+ * Key data below the removed key moves up so the free space stays contiguous
+ * @return Number of keys left in the page
+ */
+static int btree_slot_remove(DiskInterface* disk, cache *cache, uint64_t leaf_block, int index)
+{
+	void *block = get_block(disk, cache, 0, leaf_block);
+	btree_slot_page_t *page = btree_slot_page(block);
+	uint16_t offset = page->slots[index].offset;
+	uint16_t len = page->slots[index].len;
+	
+	memmove((char*)block + page->data_start + len, (char*)block + page->data_start, offset - page->data_start);
+	for (int i = 0; i < page->count; i++) {
+		if (page->slots[i].offset < offset) page->slots[i].offset += len;
+	}
+	uint16_t old_start = page->data_start;
+	page->data_start += len;
+	
+	page->count--;
+	page->slots[index] = page->slots[page->count];
+	
+	cache_mark_dirty(disk, cache, leaf_block, BTREE_SLOT_PAGE_OFFSET, sizeof(btree_slot_page_t) + (page->count + 1) * sizeof(btree_slot_t));
+	cache_mark_dirty(disk, cache, leaf_block, old_start, offset + len - old_start);
+	return page->count;
+}
+
+// Insert a byte-string key under a given hash
+static int btree_insert_hashed(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t hash, const void *key, uint16_t len, uint64_t value)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	uint64_t leaf_block = btree_insert_find(disk, cache, root_block, hash, &path, &leaf);
+	if (leaf_block != 0 && leaf.key == hash) {
+		if (btree_slot_find(get_block(disk, cache, 0, leaf_block), key, len) != -1) {
+			printf("Key already exists!\n");
+			return -1;
+		}
+		// A hash collision - the key goes next to the others in the same leaf
+		return btree_slot_add(disk, cache, leaf_block, key, len, value);
+	}
+	
+	if (BTREE_SLOT_PAGE_OFFSET + sizeof(btree_slot_page_t) + sizeof(btree_slot_t) + len > BLOCK_SIZE) return -1;
+	leaf_block = btree_insert_leaf(disk, cache, root_block, &path, leaf_block, &leaf, hash, 0);
+	
+	// Start the new leaf's page empty, whatever the block held before
+	btree_slot_page_t *page = btree_slot_page(get_block(disk, cache, 0, leaf_block));
+	page->count = 0;
+	page->data_start = BLOCK_SIZE;
+	return btree_slot_add(disk, cache, leaf_block, key, len, value);
+}
+
+// Look up a byte-string key under a given hash
+static int btree_search_hashed(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t hash, const void *key, uint16_t len, uint64_t *value)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	if (!btree_filter_check(disk, cache, root_block, hash)) return -1;
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, hash, &path);
+	if (leaf_block == 0) return -1;
+	btree_node_read(disk, cache, leaf_block, &leaf);
+	if (leaf.key != hash) return -1;
+	
+	void *block = get_block(disk, cache, 0, leaf_block);
+	int index = btree_slot_find(block, key, len);
+	if (index == -1) return -1;
+	*value = btree_slot_page(block)->slots[index].value;
+	return 0;
+}
+
+// Delete a byte-string key under a given hash; the leaf goes away with the last key of its hash
+static int btree_delete_hashed(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t hash, const void *key, uint16_t len)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, hash, &path);
+	if (leaf_block == 0) return -1;
+	btree_node_read(disk, cache, leaf_block, &leaf);
+	if (leaf.key != hash) return -1;
+	
+	int index = btree_slot_find(get_block(disk, cache, 0, leaf_block), key, len);
+	if (index == -1) return -1;
+	if (btree_slot_remove(disk, cache, leaf_block, index) == 0) btree_delete(disk, cache, root_block, hash);
+	return 0;
+}
+
+/**
+ * Insert a byte-string key
+ * The tree is keyed by the key's hash; every key with the same hash is kept
+ * in full in the slotted page of that hash's leaf
+ */
+int btree_insert_var(DiskInterface* disk, cache *cache, uint64_t root_block, const void *key, uint16_t len, uint64_t value)
+{
+	return btree_insert_hashed(disk, cache, root_block, hash_bytes(key, len), key, len, value);
+}
+
+/**
+ * Look up a byte-string key
+ */
+int btree_search_var(DiskInterface* disk, cache *cache, uint64_t root_block, const void *key, uint16_t len, uint64_t *value)
+{
+	return btree_search_hashed(disk, cache, root_block, hash_bytes(key, len), key, len, value);
+}
+
+/**
+ * Delete a byte-string key
+ */
+int btree_delete_var(DiskInterface* disk, cache *cache, uint64_t root_block, const void *key, uint16_t len)
+{
+	return btree_delete_hashed(disk, cache, root_block, hash_bytes(key, len), key, len);
+}
+
+/**
+ * Directory entry cache attached to a path index
+ */
+typedef struct btree_dcache_t
+{
+	cache *cache;
+	uint64_t root_block;         // Path index the entries belong to
+	DCache *dcache;
+	struct btree_dcache_t *next; // Next cache in the hash bucket
+} btree_dcache_t;
+
+static btree_dcache_t *btree_dcaches[BTREE_DCACHES];
+
+static DCache *btree_dcache(cache *cache, uint64_t root_block)
+{
+	btree_dcache_t *slot = btree_dcaches[root_block % BTREE_DCACHES];
+	while (slot && (slot->root_block != root_block || slot->cache != cache)) slot = slot->next;
+	return slot ? slot->dcache : NULL;
+}
+
+/**
+ * Answer repeated path lookups in a path index from memory
+ * A path index that already has a cache gets a new, empty one.
+ */
+void btree_dcache_enable(cache *cache, uint64_t root_block, uint32_t entries)
+{
+	btree_dcache_disable(cache, root_block);
+	
+	btree_dcache_t *slot = malloc(sizeof(btree_dcache_t));
+	slot->next = btree_dcaches[root_block % BTREE_DCACHES];
+	btree_dcaches[root_block % BTREE_DCACHES] = slot;
+	slot->cache = cache;
+	slot->root_block = root_block;
+	slot->dcache = dcache_create(entries);
+}
+
+/**
+ * Drop a path index's directory entry cache
+ */
+void btree_dcache_disable(cache *cache, uint64_t root_block)
+{
+	btree_dcache_t **link = &btree_dcaches[root_block % BTREE_DCACHES];
+	while (*link && ((*link)->cache != cache || (*link)->root_block != root_block)) link = &(*link)->next;
+	btree_dcache_t *slot = *link;
+	if (!slot) return;
+	
+	*link = slot->next;
+	dcache_free(slot->dcache);
+	free(slot);
+}
+
+/**
+ * Map a path to an inode number in a path index
+ * Path indexes are keyed by path_hash rather than hash_bytes, so a lookup
+ * can reuse the hash of the parent directory
+ */
+int btree_path_insert(DiskInterface* disk, cache *cache, uint64_t root_block, const char *path, uint64_t inum)
+{
+	size_t len = strlen(path);
+	if (len > UINT16_MAX) return -1;
+	
+	uint64_t hash = path_hash(path);
+	int rv = btree_insert_hashed(disk, cache, root_block, hash, path, len, inum);
+	
+	// Replaces a negative entry left by an earlier failed lookup
+	DCache *dcache = btree_dcache(cache, root_block);
+	if (dcache && rv == 0) dcache_insert(dcache, hash, path, len, inum, false);
+	return rv;
+}
+
+/**
+ * Resolve a path to its inode number in a path index
+ */
+int btree_path_lookup(DiskInterface* disk, cache *cache, uint64_t root_block, const char *path, uint64_t *inum)
+{
+	return btree_path_lookup_hash(disk, cache, root_block, path_hash(path), path, inum);
+}
+
+/**
+ * Resolve a path whose hash the caller already has
+ * With a directory entry cache, paths resolved before (found or not) are
+ * answered without touching the tree
+ */
+int btree_path_lookup_hash(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t hash, const char *path, uint64_t *inum)
+{
+	size_t len = strlen(path);
+	if (len > UINT16_MAX) return -1;
+	
+	DCache *dcache = btree_dcache(cache, root_block);
+	if (dcache) {
+		int hit = dcache_lookup(dcache, hash, path, len, inum);
+		if (hit != -1) return hit ? 0 : -1;
+	}
+	
+	int rv = btree_search_hashed(disk, cache, root_block, hash, path, len, inum);
+	// A miss leaves *inum untouched, so negative entries carry no inode
+	if (dcache) dcache_insert(dcache, hash, path, len, rv == 0 ? *inum : 0, rv != 0);
+	return rv;
+}
+
+/**
+ * Remove a path from a path index
+ */
+int btree_path_delete(DiskInterface* disk, cache *cache, uint64_t root_block, const char *path)
+{
+	size_t len = strlen(path);
+	if (len > UINT16_MAX) return -1;
+	
+	uint64_t hash = path_hash(path);
+	int rv = btree_delete_hashed(disk, cache, root_block, hash, path, len);
+	
+	// The path is known to be gone now
+	DCache *dcache = btree_dcache(cache, root_block);
+	if (dcache) dcache_insert(dcache, hash, path, len, 0, true);
+	return rv;
+}
+
+/**
+ * Borrow a child from the left sibling to rebalance the tree
+ * Moves the sibling's last child to the front of node through the parent separator
+ */
+int btree_borrow_left(DiskInterface* disk, cache *cache, BTreeNode *parent, int index, BTreeNode *node)
+{
+	if (index == 0) return -1;  // No left sibling
+	
+	BTreeNode left_sibling;
+	btree_node_read(disk, cache, parent->children[index - 1], &left_sibling);
+	
+	// Can't borrow if sibling has minimum keys
+	if (left_sibling.num_keys <= MIN_KEYS) return -1;
+	
+	// Pending messages for the borrowed child go with it
+	int last = left_sibling.num_keys;
+	if (btree_buffer_move(disk, cache, left_sibling.block_number, node->block_number, left_sibling.keys[last - 1] + 1, UINT64_MAX) != 0) return -1;
+	
+	// Make room at the front of node
+	for (int i = node->num_keys; i > 0; i--) {
+		node->keys[i] = node->keys[i - 1];
+	}
+	for (int i = node->num_keys + 1; i > 0; i--) {
+		node->children[i] = node->children[i - 1];
+		node->counts[i] = node->counts[i - 1];
+	}
+	
+	// The old separator bounds the borrowed child; the sibling's last key becomes the new one
+	uint64_t moved = left_sibling.counts[last];
+	node->keys[0] = parent->keys[index - 1];
+	node->children[0] = left_sibling.children[last];
+	node->counts[0] = moved;
+	node->num_keys++;
+	parent->keys[index - 1] = left_sibling.keys[last - 1];
+	parent->counts[index - 1] -= moved;
+	parent->counts[index] += moved;
+	left_sibling.keys[last - 1] = 0;
+	left_sibling.children[last] = 0;
+	left_sibling.counts[last] = 0;
+	left_sibling.num_keys--;
+	
+	btree_node_write(disk, cache, &left_sibling);
+	btree_node_write(disk, cache, node);
+	btree_node_write(disk, cache, parent);
+	return 0;
+}
+
+/**
+ * Borrow a child from the right sibling to rebalance the tree
+ * Moves the sibling's first child to the end of node through the parent separator
+ */
+int btree_borrow_right(DiskInterface* disk, cache *cache, BTreeNode *parent, int index, BTreeNode *node)
+{
+	if (index == parent->num_keys) return -1;  // No right sibling
+	
+	BTreeNode right_sibling;
+	btree_node_read(disk, cache, parent->children[index + 1], &right_sibling);
+	
+	// Can't borrow if sibling has minimum keys
+	if (right_sibling.num_keys <= MIN_KEYS) return -1;
+	if (btree_buffer_move(disk, cache, right_sibling.block_number, node->block_number, 0, right_sibling.keys[0]) != 0) return -1;
+	
+	uint64_t moved = right_sibling.counts[0];
+	node->keys[node->num_keys] = parent->keys[index];
+	node->children[node->num_keys + 1] = right_sibling.children[0];
+	node->counts[node->num_keys + 1] = moved;
+	node->num_keys++;
+	parent->keys[index] = right_sibling.keys[0];
+	parent->counts[index + 1] -= moved;
+	parent->counts[index] += moved;
+	
+	// Shift the sibling's remaining keys and children left
+	for (int i = 0; i < right_sibling.num_keys - 1; i++) {
+		right_sibling.keys[i] = right_sibling.keys[i + 1];
+	}
+	for (int i = 0; i < right_sibling.num_keys; i++) {
+		right_sibling.children[i] = right_sibling.children[i + 1];
+		right_sibling.counts[i] = right_sibling.counts[i + 1];
+	}
+	right_sibling.keys[right_sibling.num_keys - 1] = 0;
+	right_sibling.children[right_sibling.num_keys] = 0;
+	right_sibling.counts[right_sibling.num_keys] = 0;
+	right_sibling.num_keys--;
+	
+	btree_node_write(disk, cache, &right_sibling);
+	btree_node_write(disk, cache, node);
+	btree_node_write(disk, cache, parent);
+	return 0;
+}
+
+/**
+ * Merge two adjacent child nodes when they become too small
+ * Child index+1 is appended to child index and freed. The caller makes
+ * sure the message buffers of the two children fit in one.
+ */
+void btree_merge_children(DiskInterface* disk, cache *cache, BTreeNode* parent, int index)
+{
+	BTreeNode child_a;
+	btree_node_read(disk, cache, parent->children[index], &child_a);
+	BTreeNode child_b;
+	btree_node_read(disk, cache, parent->children[index+1], &child_b);
+	
+	// The parent separator sits between the two halves
+	child_a.keys[child_a.num_keys] = parent->keys[index];
+	for (int i = 0; i < child_b.num_keys; i++) {
+		child_a.keys[child_a.num_keys + 1 + i] = child_b.keys[i];
+	}
+	for (int i = 0; i <= child_b.num_keys; i++) {
+		child_a.children[child_a.num_keys + 1 + i] = child_b.children[i];
+		child_a.counts[child_a.num_keys + 1 + i] = child_b.counts[i];
+	}
+	child_a.num_keys += child_b.num_keys + 1;
+	
+	parent->counts[index] += parent->counts[index + 1];
+	btree_node_remove_slot(parent, index + 1);
+	btree_buffer_move(disk, cache, child_b.block_number, child_a.block_number, 0, UINT64_MAX);
+	
+	btree_node_write(disk, cache, &child_a);
+	btree_node_write(disk, cache, parent);
+	btree_node_free(disk, cache, &child_b);
+}
+
+/**
+ * Replace a root that has a single internal child by that child
+ * The root keeps its block number, so the child is copied up and freed.
+ * The root's pending messages are newer than the child's and go after them;
+ * the caller makes sure the two buffers fit in one.
+ */
+void btree_promote_root(DiskInterface* disk, cache *cache, BTreeNode* root)
+{
+	uint64_t page = root->block_number;
+	
+	BTreeNode child;
+	btree_node_read(disk, cache, root->children[0], &child);
+	
+	memcpy(root, &child, sizeof(struct BTreeNode));
+	root->block_number = page;
+	
+	btree_buffer_t buffer;
+	btree_buffer_move(disk, cache, page, child.block_number, 0, UINT64_MAX);
+	btree_buffer_read(disk, cache, child.block_number, &buffer);
+	btree_buffer_write(disk, cache, page, &buffer);
+	
+	btree_node_write(disk, cache, root);
+	btree_node_free(disk, cache, &child);
+}
+
+/**
+ * Messages of nodes that left a buffered tree with no sibling to take them
+ */
+typedef struct btree_orphans_t
+{
+	btree_message_t *messages;
+	int count;
+} btree_orphans_t;
+
+/**
+ * Rebalance the internal node at path level d once it drops below the low-water mark
+ * Nodes between BTREE_LOW_WATER and MIN_KEYS keys are left alone, so most
+ * deletes only rewrite the leaf's parent. An underflowing node merges with
+ * an adjacent sibling when the two (and their message buffers) fit in one
+ * node, continuing with the parent, which lost a child; otherwise it
+ * borrows from that sibling. In a buffered tree neither may be possible,
+ * leaving a node with a single child; once that child goes too, the empty
+ * node is dropped from its parent.
+ */
+static void btree_rebalance(DiskInterface* disk, cache *cache, BTreePath *path, int d, btree_orphans_t *orphans)
+{
+	BTreeNode node;
+	btree_node_read(disk, cache, path->blocks[d], &node);
+	
+	if (d == 0) {
+		// A root left with one internal child gives up a level
+		if (node.num_keys == 0 && node.children[0] != 0) {
+			BTreeNode child;
+			btree_node_read(disk, cache, node.children[0], &child);
+			if (!child.is_leaf && btree_buffer_fits(disk, cache, node.block_number, child.block_number)) {
+				printf("Promoting root!\n");
+				btree_route_touch(cache, path->blocks[0], 0);
+				btree_promote_root(disk, cache, &node);
+			}
+		}
+		return;
+	}
+	if (node.num_keys >= BTREE_LOW_WATER) return;
+	
+	BTreeNode parent;
+	btree_node_read(disk, cache, path->blocks[d - 1], &parent);
+	int index = path->index[d - 1];
+	int sibling_index = (index > 0) ? index - 1 : index + 1;
+	
+	if (node.children[0] == 0) {
+		// The sibling that takes over the node's key range takes its messages
+		// too. If they don't fit they are applied to the leaves later; nothing
+		// under the node is left that they would have to come after.
+		if (parent.num_keys == 0 || btree_buffer_move(disk, cache, node.block_number, parent.children[sibling_index], 0, UINT64_MAX) != 0) {
+			btree_buffer_t buffer;
+			btree_buffer_read(disk, cache, node.block_number, &buffer);
+			orphans->messages = realloc(orphans->messages, (orphans->count + buffer.count) * sizeof(btree_message_t));
+			memcpy(orphans->messages + orphans->count, buffer.messages, buffer.count * sizeof(btree_message_t));
+			orphans->count += buffer.count;
+		}
+		btree_route_touch(cache, path->blocks[0], d - 1);
+		btree_node_remove_slot(&parent, index);
+		btree_node_write(disk, cache, &parent);
+		btree_node_free(disk, cache, &node);
+		btree_rebalance(disk, cache, path, d - 1, orphans);
+		return;
+	}
+	
+	// An only child can't rebalance, but its parent (the root) can give up a level
+	if (parent.num_keys == 0) {
+		btree_rebalance(disk, cache, path, d - 1, orphans);
+		return;
+	}
+	
+	BTreeNode sibling;
+	btree_node_read(disk, cache, parent.children[sibling_index], &sibling);
+	btree_route_touch(cache, path->blocks[0], d - 1);
+	
+	if (node.num_keys + sibling.num_keys + 1 <= MAX_KEYS && btree_buffer_fits(disk, cache, node.block_number, sibling.block_number)) {
+		btree_merge_children(disk, cache, &parent, (sibling_index < index) ? sibling_index : index);
+		btree_rebalance(disk, cache, path, d - 1, orphans);
+	} else if (sibling_index < index) {
+		btree_borrow_left(disk, cache, &parent, index, &node);
+	} else {
+		btree_borrow_right(disk, cache, &parent, index, &node);
+	}
+}
+
+/**
+ * Remove the leaf the path ends on from its parent and rebalance upwards
+ */
+void btree_remove_key(DiskInterface* disk, cache *cache, BTreePath *path, BTreeNode *leaf)
+{
+	int d = path->depth - 1;
+	BTreeNode parent;
+	btree_path_count(disk, cache, path, d, -1);
+	btree_node_read(disk, cache, path->blocks[d], &parent);
+	
+	printf("Removing key %lu from block %lu\n", leaf->key, parent.block_number);
+	btree_node_remove_slot(&parent, path->index[d]);
+	btree_node_write(disk, cache, &parent);
+	btree_route_touch(cache, path->blocks[0], d);
+	
+	// Unlink the leaf from the leaf chain
+	BTreeNode neighbour;
+	if (leaf->left_sibling != 0) {
+		btree_node_read(disk, cache, leaf->left_sibling, &neighbour);
+		neighbour.right_sibling = leaf->right_sibling;
+		btree_node_write(disk, cache, &neighbour);
+	}
+	if (leaf->right_sibling != 0) {
+		btree_node_read(disk, cache, leaf->right_sibling, &neighbour);
+		neighbour.left_sibling = leaf->left_sibling;
+		btree_node_write(disk, cache, &neighbour);
+	}
+	
+	btree_orphans_t orphans = { NULL, 0 };
+	btree_rebalance(disk, cache, path, d, &orphans);
+	
+	// Orphaned messages are older than any still pending for their keys
+	for (int i = 0; i < orphans.count; i++) btree_buffer_apply(disk, cache, path->blocks[0], &orphans.messages[i]);
+	free(orphans.messages);
+}
+
+/**
+ * Delete a key from the B-tree
+ * A single descent finds the leaf; the path it leaves behind is all the
+ * rebalancing needs, so a delete reads about as many nodes as a lookup
+ */
+int btree_delete(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key)
+{
+	MemTable *memtable = btree_memtable(cache, root_block);
+	if (memtable) {
+		// The leaf goes when the tombstone is flushed
+		uint64_t leaf_block = btree_memtable_leaf(disk, cache, root_block, memtable, key);
+		if (leaf_block == 0) {
+			printf("Did not find key!\n");
+			return -1;
+		}
+		btree_memtable_put(disk, cache, root_block, memtable, key, 0, true);
+		return leaf_block;
+	}
+	
+	BTreePath path;
+	uint64_t leaf_block = btree_descend(disk, cache, root_block, key, &path);
+	BTreeNode node;
+	
+	if (leaf_block == 0) return -1;
+	btree_hint_clear(cache, root_block);
+	btree_node_read(disk, cache, leaf_block, &node);
+	if (node.key != key) {
+		printf("Did not find key!\n");
+		return -1;
+	}
+	
+	btree_remove_key(disk, cache, &path, &node);
+	btree_node_free(disk, cache, &node);
+	btree_filter_remove(cache, root_block);
+	return leaf_block;
+}
+
+/**
+ * Remember a block the current version no longer reaches
+ * It stays allocated while a snapshot of an older version may need it.
+ */
+static void btree_cow_retire(BTreeCow *tree, uint64_t block)
+{
+	if (tree->retired_count == tree->retired_size) {
+		tree->retired_size = tree->retired_size ? tree->retired_size * 2 : 64;
+		tree->retired = realloc(tree->retired, tree->retired_size * sizeof(btree_cow_retired_t));
+	}
+	tree->retired[tree->retired_count].block = block;
+	tree->retired[tree->retired_count].version = tree->version;
+	tree->retired_count++;
+}
+
+// Free the retired blocks no snapshot can reach any more
+static void btree_cow_reclaim(DiskInterface* disk, cache *cache, BTreeCow *tree)
+{
+	uint64_t oldest = tree->version;
+	for (int i = 0; i < tree->snapshot_count; i++) {
+		if (tree->snapshots[i].version < oldest) oldest = tree->snapshots[i].version;
+	}
+	
+	// Blocks are retired in version order
+	int freed = 0;
+	while (freed < tree->retired_count && tree->retired[freed].version < oldest) {
+		BTreeNode node = { .block_number = tree->retired[freed].block };
+		btree_node_free(disk, cache, &node);
+		freed++;
+	}
+	memmove(tree->retired, tree->retired + freed, (tree->retired_count - freed) * sizeof(btree_cow_retired_t));
+	tree->retired_count -= freed;
+}
+
+// Make a new root the current version
+static void btree_cow_publish(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t root_block)
+{
+	tree->root = root_block;
+	tree->version++;
+	btree_cow_reclaim(disk, cache, tree);
+}
+
+// Copy an internal node into a new block
+static BTreeNode btree_cow_copy(DiskInterface* disk, cache *cache, uint64_t block)
+{
+	BTreeNode copy = *btree_node_create(disk, cache, false);
+	uint64_t page = copy.block_number;
+	btree_node_read(disk, cache, block, &copy);
+	copy.block_number = page;
+	return copy;
+}
+
+/**
+ * Start a copy-on-write tree with an empty root
+ */
+BTreeCow *btree_cow_create(DiskInterface* disk, cache *cache)
+{
+	BTreeNode *root = btree_node_create(disk, cache, false);
+	return btree_cow_open(root->block_number);
+}
+
+/**
+ * Write to an existing tree copy-on-write from now on
+ */
+BTreeCow *btree_cow_open(uint64_t root_block)
+{
+	BTreeCow *tree = calloc(1, sizeof(BTreeCow));
+	tree->root = root_block;
+	return tree;
+}
+
+/**
+ * Chain the leaves under a node in key order after prev, the last leaf
+ * linked so far (block_number 0 before the first)
+ * Only leaves whose links are wrong are written.
+ */
+static void btree_cow_relink(DiskInterface* disk, cache *cache, uint64_t block, BTreeNode *prev)
+{
+	BTreeNode node;
+	btree_node_read(disk, cache, block, &node);
+	if (!node.is_leaf) {
+		for (int i = 0; i <= node.num_keys && node.children[i] != 0; i++) {
+			btree_cow_relink(disk, cache, node.children[i], prev);
+		}
+		return;
+	}
+	
+	if (prev->block_number != 0 && prev->right_sibling != block) {
+		prev->right_sibling = block;
+		btree_node_write(disk, cache, prev);
+	}
+	if (node.left_sibling != prev->block_number) {
+		node.left_sibling = prev->block_number;
+		btree_node_write(disk, cache, &node);
+	}
+	*prev = node;
+}
+
+/**
+ * Drop a tree's handle, freeing every retired block
+ * Snapshots taken through the handle are gone with it; the current
+ * version stays on disk under btree_cow_root. Copy-on-write writes leave
+ * the leaf chain alone, so it is rebuilt for the ordinary btree_* calls.
+ */
+void btree_cow_close(DiskInterface* disk, cache *cache, BTreeCow *tree)
+{
+	tree->snapshot_count = 0;
+	tree->version++;
+	btree_cow_reclaim(disk, cache, tree);
+	
+	BTreeNode last = { .block_number = 0 };
+	btree_cow_relink(disk, cache, tree->root, &last);
+	if (last.block_number != 0 && last.right_sibling != 0) {
+		last.right_sibling = 0;
+		btree_node_write(disk, cache, &last);
+	}
+	free(tree->snapshots);
+	free(tree->retired);
+	free(tree);
+}
+
+/**
+ * Root block of the current version
+ */
+uint64_t btree_cow_root(BTreeCow *tree)
+{
+	return tree->root;
+}
+
+/**
+ * Keep the current version readable until btree_cow_release
+ */
+uint64_t btree_cow_snapshot(BTreeCow *tree)
+{
+	for (int i = 0; i < tree->snapshot_count; i++) {
+		if (tree->snapshots[i].version == tree->version) {
+			tree->snapshots[i].refs++;
+			return tree->snapshots[i].root;
+		}
+	}
+	
+	if (tree->snapshot_count == tree->snapshot_size) {
+		tree->snapshot_size = tree->snapshot_size ? tree->snapshot_size * 2 : 8;
+		tree->snapshots = realloc(tree->snapshots, tree->snapshot_size * sizeof(btree_cow_snapshot_t));
+	}
+	btree_cow_snapshot_t *snapshot = &tree->snapshots[tree->snapshot_count++];
+	snapshot->root = btree_cow_root(tree);
+	snapshot->version = tree->version;
+	snapshot->refs = 1;
+	return snapshot->root;
+}
+
+/**
+ * Let go of a snapshot, freeing the nodes only it still reached
+ */
+void btree_cow_release(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t root_block)
+{
+	for (int i = 0; i < tree->snapshot_count; i++) {
+		btree_cow_snapshot_t *snapshot = &tree->snapshots[i];
+		if (snapshot->root != root_block) continue;
+		
+		if (--snapshot->refs == 0) {
+			*snapshot = tree->snapshots[--tree->snapshot_count];
+			btree_cow_reclaim(disk, cache, tree);
+		}
+		return;
+	}
+}
+
+/**
+ * Insert or overwrite a key by copying the path down to it
+ * Each level takes the one or two children the level below handed up;
+ * a copy that overflows is split, and a split root adds a level.
+ * @return 1 if the key existed, 0 if it was inserted, -1 if it existed and replace is false
+ */
+static int btree_cow_put(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key, uint64_t value, bool replace)
+{
+	BTreePath path;
+	BTreeNode leaf;
+	bool found = false;
+	
+	uint64_t leaf_block = btree_descend(disk, cache, btree_cow_root(tree), key, &path);
+	if (leaf_block != 0) {
+		btree_node_read(disk, cache, leaf_block, &leaf);
+		found = (leaf.key == key);
+	}
+	if (found && !replace) {
+		printf("Key %lu already exists!\n", key);
+		return -1;
+	}
+	
+	BTreeNode node = *btree_node_create(disk, cache, true);
+	node.key = key;
+	node.value = value;
+	btree_node_write(disk, cache, &node);
+	
+	uint64_t sep = 0;
+	uint64_t left = node.block_number, left_count = 1;
+	uint64_t right = 0, right_count = 0;
+	if (found) {
+		btree_cow_retire(tree, leaf_block);
+	} else if (leaf_block != 0) {
+		// The leaf the descent ended on becomes the new leaf's neighbour
+		right_count = 1;
+		if (key < leaf.key) {
+			sep = key;
+			right = leaf_block;
+		} else {
+			sep = leaf.key;
+			right = left;
+			left = leaf_block;
+		}
+	}
+	
+	for (int d = path.depth - 1; d >= 0; d--) {
+		BTreeNode copy = btree_cow_copy(disk, cache, path.blocks[d]);
+		int index = path.index[d];
+		if (right != 0) {
+			btree_node_split_slot(&copy, index, sep, left, left_count, right, right_count);
+		} else {
+			copy.children[index] = left;
+			copy.counts[index] = left_count;
+		}
+		btree_cow_retire(tree, path.blocks[d]);
+	
+		right = 0;
+		if (copy.num_keys > MAX_KEYS) {
+			BTreeNode sibling = *btree_node_create(disk, cache, false);
+			sep = btree_node_split(&copy, &sibling, btree_split_point(&copy, false));
+			btree_node_write(disk, cache, &sibling);
+			right = sibling.block_number;
+			right_count = btree_node_count(&sibling);
+		}
+		btree_node_write(disk, cache, &copy);
+		left = copy.block_number;
+		left_count = btree_node_count(&copy);
+	}
+	
+	if (right != 0) {
+		BTreeNode root = *btree_node_create(disk, cache, false);
+		root.num_keys = 1;
+		root.keys[0] = sep;
+		root.children[0] = left;
+		root.counts[0] = left_count;
+		root.children[1] = right;
+		root.counts[1] = right_count;
+		btree_node_write(disk, cache, &root);
+		left = root.block_number;
+	}
+	
+	btree_cow_publish(disk, cache, tree, left);
+	return found ? 1 : 0;
+}
+
+/**
+ * Insert a key into a copy-on-write tree
+ */
+int btree_cow_insert(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key, uint64_t value)
+{
+	return (btree_cow_put(disk, cache, tree, key, value, false) < 0) ? -1 : 0;
+}
+
+/**
+ * Set the value of a key in a copy-on-write tree, inserting it if absent
+ */
+int btree_cow_upsert(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key, uint64_t value)
+{
+	return btree_cow_put(disk, cache, tree, key, value, true);
+}
+
+/**
+ * Delete a key from a copy-on-write tree
+ * Nodes left empty are dropped instead of copied, and a root left with a
+ * single internal child hands the root over to it. Nothing else is
+ * rebalanced, since merging would copy the siblings as well.
+ */
+int btree_cow_delete(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key)
+{
+	BTreePath path;
+	BTreeNode node;
+	
+	uint64_t leaf_block = btree_descend(disk, cache, btree_cow_root(tree), key, &path);
+	if (leaf_block != 0) btree_node_read(disk, cache, leaf_block, &node);
+	if (leaf_block == 0 || node.key != key) {
+		printf("Did not find key!\n");
+		return -1;
+	}
+	btree_cow_retire(tree, leaf_block);
+	
+	// Whether the child the path took out of the level above goes away
+	bool removed = true;
+	uint64_t child = 0, child_count = 0;
+	for (int d = path.depth - 1; d >= 0; d--) {
+		btree_node_read(disk, cache, path.blocks[d], &node);
+		int index = path.index[d];
+		if (removed) {
+			btree_node_remove_slot(&node, index);
+		} else {
+			node.children[index] = child;
+			node.counts[index] = child_count;
+		}
+		btree_cow_retire(tree, path.blocks[d]);
+		if (d > 0 && node.children[0] == 0) continue;
+	
+		BTreeNode copy = *btree_node_create(disk, cache, false);
+		node.block_number = copy.block_number;
+		btree_node_write(disk, cache, &node);
+		removed = false;
+		child = node.block_number;
+		child_count = btree_node_count(&node);
+	}
+	
+	while (node.num_keys == 0 && node.children[0] != 0) {
+		BTreeNode next;
+		btree_node_read(disk, cache, node.children[0], &next);
+		if (next.is_leaf) break;
+		btree_cow_retire(tree, node.block_number);
+		node = next;
+	}
+	
+	btree_cow_publish(disk, cache, tree, node.block_number);
+	return 0;
 }
 
 /**
@@ -728,7 +2895,7 @@ void btree_print(DiskInterface* disk, cache *cache, uint64_t root_block, int lev
 	
 	if (node.is_leaf) {
 		// Print leaf node information
-		printf("LEAF key=%lu parent=%lu\n", node.key, node.parent);
+		printf("LEAF key=%lu value=%lu\n", node.key, node.value);
 	} else {
 		// Print internal node information
 		printf("INTERNAL keys=[");
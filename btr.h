@@ -14,6 +14,14 @@
 /**
  * B-tree node structure stored on disk
  * Each node occupies one disk block
+ * Internal nodes hold num_keys separators and num_keys+1 children: every key
+ * under children[i] is <= keys[i] and every key under children[i+1] is greater.
+ * Nodes don't record their parent; operations remember the path they took
+ * down from the root instead, so moving a child never rewrites it.
+ * keys and children have one spare slot so a node can overflow in memory
+ * before it is split; a node on disk never holds more than MAX_KEYS keys.
+ * counts[i] is the number of leaves under children[i], which lets rank and
+ * select queries skip whole subtrees.
  */
 typedef struct BTreeNode {
     uint64_t block_number;		// Physical block number on disk where this node is stored
@@ -21,13 +29,67 @@ typedef struct BTreeNode {
     uint64_t key;			// Actual key of node (used when node is leaf)
     uint64_t value;			// Associated value for key-value pairs (B+Tree indexes file and directory inodes)
     uint16_t num_keys;			// Current number of keys stored in this node
-    uint64_t keys[MAX_KEYS];		// Array of keys (could be inode numbers or other identifiers)
-    uint64_t children[MAX_KEYS + 1];	// Array of child block numbers (internal nodes only)
-    uint64_t parent;			// Parent node block number (0 if root)
-    uint64_t left_sibling;		// Block number of left sibling (for efficient traversal)
-    uint64_t right_sibling;		// Block number of right sibling (for efficient traversal)
+    uint64_t keys[MAX_KEYS + 1];	// Array of keys (could be inode numbers or other identifiers)
+    uint64_t children[MAX_KEYS + 2];	// Array of child block numbers (internal nodes only)
+    uint64_t counts[MAX_KEYS + 2];	// Number of keys under each child (internal nodes only)
+    uint64_t left_sibling;		// Block number of left sibling leaf (leaves only, 0 if none)
+    uint64_t right_sibling;		// Block number of right sibling leaf (leaves only, 0 if none)
 } BTreeNode;
 
+/**
+ * Internal nodes visited on the way down from the root to a leaf
+ * blocks[0] is the root; index[d] is the child slot taken out of blocks[d]
+ */
+typedef struct BTreePath {
+    int depth;				// Number of internal nodes on the path
+    uint64_t blocks[BTREE_MAX_DEPTH];	// Block number of each node on the path
+    int index[BTREE_MAX_DEPTH];		// Child slot followed out of each node
+} BTreePath;
+
+/**
+ * Read-modify-write callback for btree_update
+ * @param key Key being updated
+ * @param value Current value on entry (0 if found is false), new value on return
+ * @param found Whether the key is in the tree
+ * @param ctx Caller context passed to btree_update
+ * @return true to store value (inserting the key if absent), false to leave the tree unchanged
+ */
+typedef bool (*btree_update_fn)(uint64_t key, uint64_t *value, bool found, void *ctx);
+
+/**
+ * Version of a copy-on-write tree kept readable by btree_cow_snapshot
+ */
+typedef struct btree_cow_snapshot_t {
+    uint64_t root;			// Root block of the version
+    uint64_t version;			// Writes published before it
+    int refs;				// Outstanding btree_cow_snapshot calls
+} btree_cow_snapshot_t;
+
+/**
+ * Block a copy-on-write write replaced, freed once no snapshot reaches it
+ */
+typedef struct btree_cow_retired_t {
+    uint64_t block;			// Node block
+    uint64_t version;			// Last version the block was part of
+} btree_cow_retired_t;
+
+/**
+ * Handle of a copy-on-write tree
+ * Writes never modify a reachable node: they copy the path they change
+ * and publish the copy's root. Leaves of a copy-on-write tree aren't
+ * linked to their siblings, since relinking would copy the neighbours.
+ */
+typedef struct BTreeCow {
+    uint64_t root;			// Root block of the current version
+    uint64_t version;			// Number of writes published
+    btree_cow_snapshot_t *snapshots;	// Versions held by snapshots
+    int snapshot_count;
+    int snapshot_size;
+    btree_cow_retired_t *retired;	// Replaced blocks, in version order
+    int retired_count;
+    int retired_size;
+} BTreeCow;
+
 // ==================== B-TREE OPERATIONS ====================
 
 // ==================== NODE MANAGEMENT ====================
@@ -66,6 +128,16 @@ int btree_node_write(DiskInterface* disk, cache *cache, BTreeNode* node);
 
 // ==================== CORE B-TREE OPERATIONS ====================
 
+/**
+ * Descend from the root to the leaf that holds or would hold a key
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to look for
+ * @param path Filled with the internal nodes visited and the child taken out of each
+ * @return Block number of the leaf, or 0 if the tree is empty
+ */
+uint64_t btree_descend(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, BTreePath *path);
+
 /**
  * Search for a key in the B-tree
  * @param disk Pointer to DiskInterface
@@ -75,15 +147,51 @@ int btree_node_write(DiskInterface* disk, cache *cache, BTreeNode* node);
  */
 uint64_t btree_search(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key);
 
+/**
+ * Look up a batch of keys, sharing node visits between keys that route
+ * through the same nodes and overlapping the reads of each tree level
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param keys Keys to look up, in any order
+ * @param n Number of keys
+ * @param out Filled with the value of each key, or -1 if it is not in the tree
+ * @return Number of keys found
+ */
+int btree_multi_get(DiskInterface* disk, cache *cache, uint64_t root_block, const uint64_t *keys, int n, uint64_t *out);
+
 /**
  * Insert a key into the B-tree
  * @param disk Pointer to DiskInterface
  * @param root_block Block number of root node
  * @param key Key to insert
- * @return 0 on success, -1 on failure
+ * @return 0 on success, -1 if the key already exists. With a memtable only
+ *         keys the memtable holds are caught; an insert of a key that is
+ *         already in the tree returns 0 and is dropped when it is flushed.
  */
 int btree_insert(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value);
 
+/**
+ * Set the value of a key, inserting the key if it isn't in the tree
+ * An existing key's value is overwritten in place after a single descent
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to set
+ * @param value Value to store
+ * @return 1 if an existing key was updated, 0 if the key was inserted
+ */
+int btree_upsert(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value);
+
+/**
+ * Read-modify-write the value of a key in a single descent
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to update
+ * @param fn Called once with the current value; decides whether to store it
+ * @param ctx Passed through to fn
+ * @return 1 if the key was in the tree, 0 if it was absent (and inserted if fn stored a value)
+ */
+int btree_update(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, btree_update_fn fn, void *ctx);
+
 /**
  * Delete a key from the B-tree
  * @param disk Pointer to DiskInterface
@@ -93,18 +201,268 @@ int btree_insert(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_
  */
 int btree_delete(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key);
 
+// ==================== BUFFERED WRITES ====================
+
+/*
+ * A tree written through the buffered operations is a Bε-tree: each
+ * internal node's block keeps a buffer of pending insert, upsert and
+ * delete messages after the node. Writes only append to the root's buffer;
+ * a full buffer pushes its largest per-child batch one level down, and
+ * batches reaching the bottom level are applied to the leaves together.
+ * While messages are pending, read the tree with btree_get; the other
+ * queries (btree_search, multi-get, rank, range counts, Bloom filter) only
+ * see the leaves until btree_buffer_drain has run.
+ */
+
+/**
+ * Insert a key into a buffered tree unless it is already there
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to insert
+ * @param value Value to store if the key is absent
+ */
+void btree_insert_buffered(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value);
+
+/**
+ * Set the value of a key in a buffered tree, inserting the key if absent
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to set
+ * @param value Value to store
+ */
+void btree_upsert_buffered(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t value);
+
+/**
+ * Delete a key from a buffered tree if it is there
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to delete
+ */
+void btree_delete_buffered(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key);
+
+/**
+ * Look up a key, taking pending messages into account
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to look up
+ * @param value Set to the key's value if it is found
+ * @return 0 if the key is in the tree, -1 otherwise
+ */
+int btree_get(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key, uint64_t *value);
+
+/**
+ * Apply every pending message of a buffered tree to its leaves
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ */
+void btree_buffer_drain(DiskInterface* disk, cache *cache, uint64_t root_block);
+
+// ==================== MEMTABLE ====================
+
+/*
+ * With a memtable enabled, btree_insert, btree_upsert, btree_update and
+ * btree_delete write into an in-memory skiplist instead of the tree, and
+ * btree_search, btree_get and btree_multi_get look there first. A full memtable is
+ * applied to the tree in key order. Rank, select and range counts only
+ * see what has been flushed, and nothing in the memtable survives a crash
+ * until it is flushed, so flush before cache_sync.
+ *
+ * btree_insert doesn't read the tree: it only fails for keys the memtable
+ * holds, and a key that turns out to be in the tree keeps its value when
+ * the insert is flushed. btree_search and btree_delete return leaf blocks
+ * as usual; when only the memtable has a key's current value, that one key
+ * is written through to the tree to get a leaf, and the rest of the table
+ * stays batched. A deleted leaf is freed when its tombstone is flushed.
+ */
+
+/**
+ * Put a memtable in front of a tree
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param entries Number of keys the memtable holds before it is flushed
+ */
+void btree_memtable_enable(DiskInterface* disk, cache *cache, uint64_t root_block, uint32_t entries);
+
+/**
+ * Flush and drop a tree's memtable
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ */
+void btree_memtable_disable(DiskInterface* disk, cache *cache, uint64_t root_block);
+
+/**
+ * Apply the writes held in a tree's memtable to the tree, in key order
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ */
+void btree_memtable_flush(DiskInterface* disk, cache *cache, uint64_t root_block);
+
+/**
+ * Count the keys smaller than a key
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key to rank (need not be in the tree)
+ * @return Number of keys in the tree smaller than key
+ */
+uint64_t btree_rank(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t key);
+
+/**
+ * Count the keys in a closed range
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param low Smallest key counted
+ * @param high Largest key counted
+ * @return Number of keys k with low <= k <= high
+ */
+uint64_t btree_count_range(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t low, uint64_t high);
+
+/**
+ * Find the key at a given position in key order
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param rank Position of the key, 0 for the smallest
+ * @param key Filled with the key found
+ * @param value Filled with its value
+ * @return 0 on success, -1 if the tree holds rank keys or fewer
+ */
+int btree_select(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t rank, uint64_t *key, uint64_t *value);
+
+// ==================== BYTE-STRING KEYS ====================
+
+/**
+ * Insert a variable-length key
+ * Trees used with these calls are keyed by hash_bytes of the key; the full
+ * keys sharing a hash are kept in a slotted page in that hash's leaf
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param key Key bytes
+ * @param len Number of key bytes
+ * @param value Value to store
+ * @return 0 on success, -1 if the key exists or doesn't fit in its leaf
+ */
+int btree_insert_var(DiskInterface* disk, cache *cache, uint64_t root_block, const void *key, uint16_t len, uint64_t value);
+
+/**
+ * Look up a variable-length key
+ * @param value Filled with the key's value if found
+ * @return 0 if found, -1 if not
+ */
+int btree_search_var(DiskInterface* disk, cache *cache, uint64_t root_block, const void *key, uint16_t len, uint64_t *value);
+
+/**
+ * Delete a variable-length key
+ * @return 0 on success, -1 if key not found
+ */
+int btree_delete_var(DiskInterface* disk, cache *cache, uint64_t root_block, const void *key, uint16_t len);
+
+/**
+ * Path index: map a path to an inode number, keyed by path_hash
+ * Paths are compared byte for byte, so they should be stored and looked up
+ * in one canonical form
+ * @param path Null-terminated path
+ * @param inum Inode number of the path
+ * @return 0 on success, -1 if the path is already indexed
+ */
+int btree_path_insert(DiskInterface* disk, cache *cache, uint64_t root_block, const char *path, uint64_t inum);
+
+/**
+ * Resolve a path through a path index
+ * @param inum Filled with the path's inode number if found
+ * @return 0 if found, -1 if not
+ */
+int btree_path_lookup(DiskInterface* disk, cache *cache, uint64_t root_block, const char *path, uint64_t *inum);
+
+/**
+ * Resolve a path through a path index given its path_hash
+ * Lets a walk down a directory tree extend the parent's hash with
+ * path_hash_component instead of hashing every prefix from scratch
+ * @param hash path_hash of path
+ * @param inum Filled with the path's inode number if found
+ * @return 0 if found, -1 if not
+ */
+int btree_path_lookup_hash(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t hash, const char *path, uint64_t *inum);
+
+/**
+ * Remove a path from a path index
+ * @return 0 on success, -1 if the path isn't indexed
+ */
+int btree_path_delete(DiskInterface* disk, cache *cache, uint64_t root_block, const char *path);
+
+/**
+ * Cache path lookups in a path index, including paths that weren't found
+ * Inserts and deletes through btree_path_insert and btree_path_delete keep
+ * the cached entries up to date; CLOCK evicts once entries are in use
+ * @param root_block Block number of root node
+ * @param entries Number of paths to cache
+ */
+void btree_dcache_enable(cache *cache, uint64_t root_block, uint32_t entries);
+
+/**
+ * Drop the directory entry cache of a path index
+ * @param root_block Block number of root node
+ */
+void btree_dcache_disable(cache *cache, uint64_t root_block);
+
+// ==================== BLOOM FILTER ====================
+
+/**
+ * Attach a Bloom filter to a tree so lookups of absent keys usually skip
+ * the descent
+ * The filter is filled with the tree's current keys and kept up to date by
+ * inserts; its bits are written through to newly allocated blocks.
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param expected_keys Number of keys to size the filter for
+ * @return Block number of the filter header, for btree_filter_open
+ */
+uint64_t btree_filter_create(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t expected_keys);
+
+/**
+ * Attach a filter saved by btree_filter_create to its tree again
+ * @param disk Pointer to DiskInterface
+ * @param root_block Block number of root node
+ * @param header_block Block number returned by btree_filter_create
+ * @return 0 on success, -1 if header_block doesn't hold a filter
+ */
+int btree_filter_open(DiskInterface* disk, cache *cache, uint64_t root_block, uint64_t header_block);
+
+/**
+ * Detach a tree's filter, leaving its blocks on disk
+ * @param root_block Block number of root node
+ */
+void btree_filter_close(cache *cache, uint64_t root_block);
+
+// ==================== ROUTING TABLE ====================
+
+/**
+ * Route a tree's descents through an in-memory copy of its upper
+ * BTREE_ROUTE_LEVELS levels
+ * The table is built by the next descent and rebuilt after any split,
+ * merge or borrow that changes a routed node.
+ * @param root_block Block number of root node
+ */
+void btree_route_enable(cache *cache, uint64_t root_block);
+
+/**
+ * Stop routing a tree's descents in memory
+ * @param root_block Block number of root node
+ */
+void btree_route_disable(cache *cache, uint64_t root_block);
+
 // ==================== INTERNAL OPERATIONS ====================
 
 /**
- * Split the root node when it becomes full
- * Creates two new child nodes and updates root
+ * Split the root node when it overflows
+ * Creates two new child nodes and updates root; the root keeps its block
  * @param disk Pointer to DiskInterface
  * @param root Pointer to root node to split
  */
 void btree_split_root(DiskInterface* disk, cache *cache, BTreeNode* root);
 
 /**
- * Split a full child node
+ * Split an overflowing child node
+ * Writes the child and its new right sibling; the parent gains a child
+ * in memory and is left for the caller to write or split
  * @param disk Pointer to DiskInterface
  * @param node Pointer to parent node
  * @param index Index of child to split
@@ -114,12 +472,102 @@ void btree_split_child(DiskInterface* disk, cache *cache, BTreeNode* node, int i
 
 /**
  * Merge two adjacent child nodes when they become too small
+ * Child index+1 is appended to child index and freed; the parent is written
  * @param disk Pointer to DiskInterface
  * @param parent Pointer to parent node
  * @param index Index of first child to merge
  */
 void btree_merge_children(DiskInterface* disk, cache *cache, BTreeNode* parent, int index);
 
+// ==================== COPY-ON-WRITE ====================
+
+/*
+ * Any read-only operation (btree_search, btree_multi_get, rank, select,
+ * range counts) works on btree_cow_root or a snapshot root, and keeps
+ * seeing that version while later writes publish new ones, since the nodes
+ * of a published version never change. Reads still go through the cache,
+ * which is not thread-safe, so reads, writes, snapshots and releases all
+ * happen on the thread that owns the cache.
+ *
+ * Copy-on-write writes don't keep the leaf chain linked, so the ordinary
+ * btree_* writes must not touch the tree until btree_cow_close has
+ * relinked it.
+ */
+
+/**
+ * Create an empty copy-on-write tree
+ * @param disk Pointer to DiskInterface
+ * @return Handle of the tree
+ */
+BTreeCow *btree_cow_create(DiskInterface* disk, cache *cache);
+
+/**
+ * Write to an existing tree copy-on-write from now on
+ * @param root_block Block number of root node
+ * @return Handle of the tree
+ */
+BTreeCow *btree_cow_open(uint64_t root_block);
+
+/**
+ * Free a tree's handle and every block retired through it
+ * Outstanding snapshots become invalid; the current version stays on disk
+ * with its leaf chain relinked.
+ * @param disk Pointer to DiskInterface
+ * @param tree Handle of the tree
+ */
+void btree_cow_close(DiskInterface* disk, cache *cache, BTreeCow *tree);
+
+/**
+ * Get the root block of the current version
+ * @param tree Handle of the tree
+ * @return Root block; it changes with every write
+ */
+uint64_t btree_cow_root(BTreeCow *tree);
+
+/**
+ * Keep the current version readable until it is released
+ * @param tree Handle of the tree
+ * @return Root block of the snapshot
+ */
+uint64_t btree_cow_snapshot(BTreeCow *tree);
+
+/**
+ * Release a snapshot, freeing nodes no remaining version reaches
+ * @param disk Pointer to DiskInterface
+ * @param tree Handle of the tree
+ * @param root_block Root block returned by btree_cow_snapshot
+ */
+void btree_cow_release(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t root_block);
+
+/**
+ * Insert a key into a copy-on-write tree
+ * @param disk Pointer to DiskInterface
+ * @param tree Handle of the tree
+ * @param key Key to insert
+ * @param value Value to store
+ * @return 0 on success, -1 if the key already exists
+ */
+int btree_cow_insert(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key, uint64_t value);
+
+/**
+ * Set the value of a key in a copy-on-write tree, inserting it if absent
+ * @param disk Pointer to DiskInterface
+ * @param tree Handle of the tree
+ * @param key Key to set
+ * @param value Value to store
+ * @return 1 if an existing key was updated, 0 if the key was inserted
+ */
+int btree_cow_upsert(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key, uint64_t value);
+
+/**
+ * Delete a key from a copy-on-write tree
+ * @param disk Pointer to DiskInterface
+ * @param tree Handle of the tree
+ * @param key Key to delete
+ * @return 0 on success, -1 if the key is not in the tree
+ */
+int btree_cow_delete(DiskInterface* disk, cache *cache, BTreeCow *tree, uint64_t key);
+
 // ==================== DEBUGGING ====================
 
 /**
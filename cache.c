@@ -1,84 +1,468 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include <sys/sysinfo.h>
 #include <sys/param.h>
-#include <bsd/stdlib.h>
 #include "disk.h"
 #include "types.h"
 #include "cache.h"
 
+/**
+ * Release the bytes of a checkpoint snapshot
+ * Snapshots are cleared the same way as the page they were copied from
+ */
+static void
+cache_shadow_release(cache *cache, cache_shadow_t *shadow)
+{
+	if (si_lookup(cache->sensitive, cache->inode_number[shadow->index]))
+		sanitize_random(shadow->data, shadow->len);
+	else
+		sanitize(cache->sanitize, shadow->data, shadow->len);
+	free(shadow->data);
+	shadow->data = NULL;
+	cache->meta[shadow->index].flags &= ~CACHE_FLAG_FLUSHING;
+}
+
+/**
+ * Write a checkpoint snapshot to disk and release it
+ */
+static void
+cache_shadow_write(DiskInterface* disk, cache *cache, cache_shadow_t *shadow)
+{
+	disk_write_range(disk, shadow->block_number, shadow->offset, shadow->len, shadow->data);
+	cache_shadow_release(cache, shadow);
+}
+
+/**
+ * Write out the pending checkpoint snapshot of an entry, if it has one
+ * Must run before the entry's newer contents reach the disk or leave the
+ * cache, otherwise the older snapshot would land on top of them later
+ */
+static void
+cache_shadow_flush(DiskInterface* disk, cache *cache, int index)
+{
+	if (cache->meta[index].flags & CACHE_FLAG_FLUSHING)
+		cache_shadow_write(disk, cache, &cache->checkpoint[cache->shadow_slot[index]]);
+}
+
+/**
+ * Write the dirty part of a cache entry back to disk
+ * Only the byte range touched since the last writeback is copied out
+ */
+static void
+cache_writeback(DiskInterface* disk, cache *cache, int index)
+{
+	cache_meta_t *meta = &cache->meta[index];
+	cache_shadow_flush(disk, cache, index);
+	disk_write_range(disk, meta->block_number, meta->dirty_start, meta->dirty_end - meta->dirty_start, cache->page_data[index] + meta->dirty_start);
+	meta->dirty_start = 0;
+	meta->dirty_end = 0;
+}
+
+/**
+ * Reclaim callbacks for pages retired while readers may still hold them
+ */
+static void
+cache_page_reclaim(void *page, void *ctx)
+{
+	sanitize(((cache*)ctx)->sanitize, page, BLOCK_SIZE);
+	free(page);
+}
+
+static void
+cache_sensitive_page_reclaim(void *page, void *ctx)
+{
+	(void)ctx;
+	sanitize_random(page, BLOCK_SIZE);
+	free(page);
+}
+
+/**
+ * Release the page of a cache entry
+ * Pages of sensitive inodes are randomized, others follow the cache's policy.
+ * With epoch reclamation enabled this is deferred until the epoch has moved
+ * past every critical section that was open when it was evicted.
+ */
+static void
+cache_free_page(cache *cache, int index)
+{
+	bool sensitive = si_lookup(cache->sensitive, cache->inode_number[index]);
+	if (cache->ebr)
+	{
+		ebr_retire(cache->ebr, cache->ebr_tid, cache->page_data[index], sensitive ? cache_sensitive_page_reclaim : cache_page_reclaim, cache);
+		cache->page_data[index] = NULL;
+		return;
+	}
+	if (sensitive)
+		sanitize_random(cache->page_data[index], BLOCK_SIZE);
+	else
+		sanitize(cache->sanitize, cache->page_data[index], BLOCK_SIZE);
+	free(cache->page_data[index]);
+	cache->page_data[index] = NULL;
+}
+
+/**
+ * Evict the least recently used entry and return its slot to the free list
+ */
+static void
+cache_evict(DiskInterface* disk, cache *cache)
+{
+	// Get least recently used cache entry
+	uint32_t cache_index = lru_pop(cache);
+	
+	// If evicted entry is dirty, write it back to disk
+	if (cache->meta[cache_index].dirty_bit)
+	{
+		block_type_t *block_type = (block_type_t*)cache->page_data[cache_index];
+		// Write dirty data back to disk
+		cache_writeback(disk, cache, cache_index);
+		cache->stats.writebacks++;
+		// Remove from dirty list if it's a data block
+		if (block_type==BLOCK_TYPE_DATA) dl_remove_block(cache->dirty_list, cache->inode_number[cache_index], cache->meta[cache_index].block_number);
+		// Remove from global dirty list
+		gdl_pop(cache, cache_index);
+		cache->meta[cache_index].dirty_bit = false;
+	}
+	// A clean entry may still have a checkpoint snapshot in flight
+	cache_shadow_flush(disk, cache, cache_index);
+	// The page is clean now - keep a compressed copy below the cache
+	if (cache->ztier && !si_lookup(cache->sensitive, cache->inode_number[cache_index]))
+		zt_put(cache->ztier, cache->meta[cache_index].block_number, cache->page_data[cache_index]);
+	if (cache->l2 && !si_lookup(cache->sensitive, cache->inode_number[cache_index]))
+		l2_put(cache->l2, cache->meta[cache_index].block_number, cache->page_data[cache_index]);
+	cache_free_page(cache, cache_index);
+	cache->meta[cache_index].flags &= ~CACHE_FLAG_RESIDENT;
+	// Remove old mapping from primary cache index
+	pci_delete(cache->pci, cache->meta[cache_index].block_number);
+	// Add evicted slot back to free list
+	fl_push(cache, cache_index);
+}
+
+/**
+ * Find the asynchronous read in flight for a block, or NULL
+ */
+static CACHE_Pending *
+cache_pending_lookup(cache *cache, uint64_t pnum)
+{
+	CACHE_Pending *current = cache->pending[pnum % HASHMAP_SIZE];
+	while (current && current->req.block_number!=pnum) current = current->next;
+	return current;
+}
+
+/**
+ * Claim a cache entry for a block without reading it from disk
+ * The caller is responsible for filling in the page contents
+ */
+static int
+cache_install(DiskInterface* disk, cache *cache, uint64_t inum, uint64_t pnum)
+{
+	// If no free cache slots, evict LRU entry
+	if (cache->free_count==0) {
+		cache_evict(disk, cache);
+		cache->stats.evictions++;
+	}
+	
+	// Get a free cache slot
+	uint32_t index = fl_pop(cache);
+	
+	// Initialize the new cache entry
+	cache->meta[index].dirty_bit = false;
+	cache->meta[index].dirty_start = 0;
+	cache->meta[index].dirty_end = 0;
+	cache->meta[index].pin_count = 0;
+	cache->meta[index].block_number = pnum;
+	cache->inode_number[index] = inum;
+	cache->meta[index].flags = CACHE_FLAG_RESIDENT;
+	cache->page_data[index] = malloc(BLOCK_SIZE);
+	
+	// Add to LRU list (most recently used)
+	lru_push(cache, index);
+	
+	// Add mapping to primary cache index
+	pci_insert(cache->pci, pnum, index);
+	
+	// A read of this block already in flight may return data older than this entry will hold
+	if (cache->pending_count)
+	{
+		CACHE_Pending *pending = cache_pending_lookup(cache, pnum);
+		if (pending) pending->stale = true;
+	}
+	return index;
+}
+
+/**
+ * Move a resident cache entry to the most recently used position
+ */
+static void
+cache_touch(cache *cache, int index)
+{
+	lru_touch(cache, index);
+}
+
+/**
+ * Record that bytes [offset, offset+len) of a resident entry were modified
+ * Widens the entry's dirty range and links it into the dirty lists once
+ */
+static void
+cache_dirty_index(cache *cache, int index, uint32_t offset, uint32_t len)
+{
+	cache_meta_t *meta = &cache->meta[index];
+	
+	if (meta->dirty_bit)
+	{
+		// Already on the dirty lists - just widen the dirty range
+		meta->dirty_start = MIN(meta->dirty_start, offset);
+		meta->dirty_end = MAX(meta->dirty_end, offset + len);
+		return;
+	}
+	
+	// Get block type to determine if we need dirty list tracking
+	block_type_t *block_type = (block_type_t*)cache->page_data[index];
+	
+	// Mark as dirty since it now differs from disk
+	meta->dirty_bit = true;
+	
+	// Any copy in the L2 log is stale from now on
+	if (cache->l2) l2_invalidate(cache->l2, meta->block_number);
+	meta->dirty_start = offset;
+	meta->dirty_end = offset + len;
+	
+	// Add to per-inode dirty list if it's a data block
+	if (block_type==BLOCK_TYPE_DATA) dl_insert(cache->dirty_list, cache->inode_number[index], meta->block_number);
+	
+	// Add to global dirty list for sync operations
+	gdl_push(cache, index);
+}
+
+/**
+ * Read a block from below the cache
+ * The compressed tier is checked before falling back to the disk
+ */
+static void
+cache_read_below(DiskInterface* disk, cache *cache, uint64_t pnum, void *page)
+{
+	if (cache->ztier && zt_get(cache->ztier, pnum, page)) return;
+	if (cache->l2 && l2_get(cache->l2, pnum, page)) return;
+	disk_read_block(disk, pnum, page);
+}
+
+/**
+ * Fill a freshly installed entry with the block's current contents
+ * A copy still held in the transient buffer is newer than the disk
+ */
+static void
+cache_fill(DiskInterface* disk, cache *cache, int index)
+{
+	uint64_t pnum = cache->meta[index].block_number;
+	if (cache->transient_block==pnum)
+	{
+		memcpy(cache->page_data[index], cache->transient, BLOCK_SIZE);
+		cache->transient_block = CACHE_NO_BLOCK;
+		return;
+	}
+	
+	// Load block data from disk into cache
+	printf("Copying page %lu into the cache!\n", pnum);
+	cache_read_below(disk, cache, pnum, cache->page_data[index]);
+}
+
+/**
+ * TinyLFU admission: only let a missed block displace the LRU victim
+ * if it has been accessed more often than the victim recently
+ */
+static bool
+cache_admit(cache *cache, uint64_t pnum)
+{
+	if (cache->sketch==NULL || cache->free_count>0) return true;
+	
+	uint64_t victim = cache->meta[cache->lru_links[cache->lru].prev].block_number;
+	return cms_estimate(cache->sketch, pnum) > cms_estimate(cache->sketch, victim);
+}
+
+/**
+ * Make sure a block has a cache entry, loading it if necessary
+ * Used by the write paths, which always admit the block
+ */
+static int
+cache_load(DiskInterface* disk, cache *cache, uint64_t inum, uint64_t pnum)
+{
+	int index = pci_lookup(cache->pci, pnum);
+	if (index==-1)
+	{
+		index = cache_install(disk, cache, inum, pnum);
+		cache_fill(disk, cache, index);
+	}
+	else cache_touch(cache, index);
+	return index;
+}
+
 void*
 get_block(DiskInterface* disk, cache *cache, uint64_t inum, uint64_t pnum)
 {
+	if (cache->sketch) cms_increment(cache->sketch, pnum);
+	
 	// Check if block is already in cache using primary cache index
 	int rv = pci_lookup(cache->pci, pnum);
 	if (rv==-1) {
-		// Block not in cache - need to load it
-		
-		// If no free cache slots, evict LRU entry
-		if (cache->free_list==NULL) {
-			// Get least recently used cache entry
-			int cache_index = lru_pop(cache, cache->lru);
-			
-			// If evicted entry is dirty, write it back to disk
-			if (cache->cache[cache_index].dirty_bit)
-			{
-				block_type_t *block_type = (block_type_t*)cache->cache[cache_index].page_data;
-				// Write dirty data back to disk
-				disk_write_block(disk, cache->cache[cache_index].block_number, cache->cache[cache_index].page_data);
-				free(cache->cache[cache_index].page_data);
-				// Remove from dirty list if it's a data block
-				if (block_type==BLOCK_TYPE_DATA) dl_remove_block(cache->dirty_list, cache->cache[cache_index].inode_number, cache->cache[cache_index].block_number);
-				// Remove from global dirty list
-				gdl_pop(cache, cache->cache[cache_index].gdl_pos);
-			}
-			// Remove old mapping from primary cache index
-			pci_delete(cache->pci, cache->cache[cache_index].block_number);
-			// Add evicted slot back to free list
-			cache->free_list = fl_push(cache->free_list, cache_index);
-		}
-		
-		// Get a free cache slot
-		int index = cache->free_list->index;
-		cache->free_list = fl_pop(cache->free_list);
+		cache->stats.misses++;
 		
-		// Initialize the new cache entry
-		cache->cache[index].dirty_bit = false;
-		cache->cache[index].pin_count = 0;
-		cache->cache[index].block_number = pnum;
-		cache->cache[index].inode_number = inum;
-		cache->cache[index].page_data = malloc(BLOCK_SIZE);
+		// Already sitting in the transient buffer from the previous miss
+		if (cache->transient_block==pnum) return cache->transient;
 		
-		// Load block data from disk into cache
-		printf("Copying page %lu into the cache!\n", pnum);
-		disk_read_block(disk, pnum, cache->cache[index].page_data);
+		if (!cache_admit(cache, pnum))
+		{
+			// Not worth more than the victim - serve it without polluting the cache
+			cache->stats.rejected++;
+			cache_read_below(disk, cache, pnum, cache->transient);
+			cache->transient_block = pnum;
+			cache->transient_inum = inum;
+			return cache->transient;
+		}
 		
-		// Add to LRU list (most recently used)
-		cache->cache[index].lru_pos = lru_push(cache, index);
-		cache->lru = cache->cache[index].lru_pos;
+		// Block not in cache - claim a slot for it
+		int index = cache_install(disk, cache, inum, pnum);
+		cache_fill(disk, cache, index);
 		
-		// Add mapping to primary cache index
-		pci_insert(cache->pci, pnum, index);
-		return cache->cache[index].page_data;
+		return cache->page_data[index];
 	} else {
+		cache->stats.hits++;
 		// Block found in cache - update LRU position
-		if (cache->lru_size > 1) {                                                                   
-			LRU_List *curr = cache->cache[rv].lru_pos;
-			curr->prev->next = curr->next;
-			curr->next->prev = curr->prev;
-			                                    
-			if (cache->lru == curr) {
-				cache->lru = curr->next;
+		cache_touch(cache, rv);
+		return cache->page_data[rv];
+	}
+}
+
+int
+get_block_async(DiskInterface* disk, cache *cache, uint64_t inum, uint64_t pnum, cache_callback_t callback, void *ctx)
+{
+	// Cached blocks, and every block when there is no worker pool, are served right away
+	if (!cache->aio || cache->transient_block==pnum || pci_lookup(cache->pci, pnum)!=-1)
+	{
+		callback(get_block(disk, cache, inum, pnum), ctx);
+		return 1;
+	}
+	
+	if (cache->sketch) cms_increment(cache->sketch, pnum);
+	cache->stats.misses++;
+	
+	CACHE_Waiter *waiter = malloc(sizeof(CACHE_Waiter));
+	waiter->fn = callback;
+	waiter->ctx = ctx;
+	waiter->next = NULL;
+	
+	CACHE_Pending *pending = cache_pending_lookup(cache, pnum);
+	if (pending)
+	{
+		// Someone is already reading this block - wait for that read
+		pending->waiters_tail->next = waiter;
+		pending->waiters_tail = waiter;
+		cache->stats.coalesced++;
+		return 0;
+	}
+	
+	// Issue a read into a staging buffer; the entry is claimed when it completes
+	pending = malloc(sizeof(CACHE_Pending));
+	pending->inum = inum;
+	pending->stale = false;
+	pending->waiters = waiter;
+	pending->waiters_tail = waiter;
+	pending->req.block_number = pnum;
+	pending->req.buf = malloc(BLOCK_SIZE);
+	pending->req.ctx = pending;
+	pending->next = cache->pending[pnum % HASHMAP_SIZE];
+	cache->pending[pnum % HASHMAP_SIZE] = pending;
+	cache->pending_count++;
+	
+	aio_submit(cache->aio, &pending->req);
+	return 0;
+}
+
+/**
+ * Unlink a completed asynchronous read from the in-flight map
+ */
+static void
+cache_pending_remove(cache *cache, CACHE_Pending *pending)
+{
+	CACHE_Pending **link = &cache->pending[pending->req.block_number % HASHMAP_SIZE];
+	while (*link!=pending) link = &(*link)->next;
+	*link = pending->next;
+	cache->pending_count--;
+}
+
+/**
+ * Release a pending read with its staging buffer and any waiters left
+ */
+static void
+cache_pending_free(cache *cache, CACHE_Pending *pending)
+{
+	if (si_lookup(cache->sensitive, pending->inum))
+		sanitize_random(pending->req.buf, BLOCK_SIZE);
+	else
+		sanitize(cache->sanitize, pending->req.buf, BLOCK_SIZE);
+	free(pending->req.buf);
+	while (pending->waiters)
+	{
+		CACHE_Waiter *waiter = pending->waiters;
+		pending->waiters = waiter->next;
+		free(waiter);
+	}
+	free(pending);
+}
+
+int cache_poll(DiskInterface* disk, cache *cache, bool wait)
+{
+	if (!cache->aio || cache->pending_count==0) return 0;
+	
+	int completed = 0;
+	AIO_Request *done = aio_reap(cache->aio, wait);
+	while (done)
+	{
+		CACHE_Pending *pending = done->ctx;
+		uint64_t pnum = done->block_number;
+		done = done->next;
+		cache_pending_remove(cache, pending);
+		
+		// Install the block unless the cache got its own copy while the read was in flight
+		if (!pending->stale && cache->transient_block!=pnum && pci_lookup(cache->pci, pnum)==-1)
+		{
+			if (cache_admit(cache, pnum))
+			{
+				int index = cache_install(disk, cache, pending->inum, pnum);
+				memcpy(cache->page_data[index], pending->req.buf, BLOCK_SIZE);
+				// The page is resident again, so drop any compressed copy as cache_fill would
+				if (cache->ztier) zt_invalidate(cache->ztier, pnum);
+			}
+			else
+			{
+				cache->stats.rejected++;
+				memcpy(cache->transient, pending->req.buf, BLOCK_SIZE);
+				cache->transient_block = pnum;
+				cache->transient_inum = pending->inum;
+			}
+		}
+		
+		// A callback may evict the block, so look it up again for every waiter
+		while (pending->waiters)
+		{
+			CACHE_Waiter *waiter = pending->waiters;
+			pending->waiters = waiter->next;
+			void *page;
+			int index = pci_lookup(cache->pci, pnum);
+			if (index!=-1)
+			{
+				cache_touch(cache, index);
+				page = cache->page_data[index];
 			}
-			                                                            
-			curr->next = cache->lru;
-			curr->prev = cache->lru->prev;
-			cache->lru->prev->next = curr;
-			cache->lru->prev = curr;
-			cache->lru = curr;
+			else if (cache->transient_block==pnum) page = cache->transient;
+			else page = cache->page_data[cache_load(disk, cache, pending->inum, pnum)];
+			waiter->fn(page, waiter->ctx);
+			free(waiter);
 		}
-		return cache->cache[rv].page_data;
+		cache_pending_free(cache, pending);
+		completed++;
 	}
+	return completed;
 }
 
 void
@@ -88,33 +472,59 @@ write_block(DiskInterface* disk, cache *cache, void *buf, uint64_t inum, uint64_
 	int index = pci_lookup(cache->pci, pnum);
 	if (index==-1)
 	{
-		// Block not in cache - load it first
-		get_block(disk, cache, inum, pnum);
-		index = pci_lookup(cache->pci, pnum);
+		// Block not in cache - the whole page is about to be overwritten,
+		// so install a fresh frame instead of reading the old contents
+		index = cache_install(disk, cache, inum, pnum);
+		if (cache->transient_block==pnum) cache->transient_block = CACHE_NO_BLOCK;
+		if (cache->ztier) zt_invalidate(cache->ztier, pnum);
 	}
-	
-	// Get block type to determine if we need dirty list tracking
-	block_type_t *block_type = (block_type_t*)cache->cache[index].page_data;
+	else cache_touch(cache, index);
 	
 	// Copy new data into cache
-	memcpy(cache->cache[index].page_data, buf, BLOCK_SIZE);
+	memcpy(cache->page_data[index], buf, BLOCK_SIZE);
 	
-	// Mark as dirty since it now differs from disk
-	cache->cache[index].dirty_bit = true;
+	cache_dirty_index(cache, index, 0, BLOCK_SIZE);
+}
+
+void
+write_block_range(DiskInterface* disk, cache *cache, const void *buf, uint64_t inum, uint64_t pnum, uint32_t offset, uint32_t len)
+{
+	assert(offset + len <= BLOCK_SIZE);
 	
-	// Add to per-inode dirty list if it's a data block
-	if (block_type==BLOCK_TYPE_DATA) dl_insert(cache->dirty_list, inum, pnum);
+	// A range covering the whole block doesn't need the old contents
+	if (offset==0 && len==BLOCK_SIZE) return write_block(disk, cache, (void*)buf, inum, pnum);
 	
-	// Add to global dirty list for sync operations
-	cache->gdl = gdl_push(cache, index);
-	cache->cache[index].gdl_pos = cache->gdl;
+	// Partial write - the untouched bytes must come from disk on a miss
+	int index = cache_load(disk, cache, inum, pnum);
+	
+	// Copy only the touched bytes into cache
+	memcpy(cache->page_data[index] + offset, buf, len);
+	
+	cache_dirty_index(cache, index, offset, len);
+}
+
+void
+cache_mark_dirty(DiskInterface* disk, cache *cache, uint64_t pnum, uint32_t offset, uint32_t len)
+{
+	int index = pci_lookup(cache->pci, pnum);
+	
+	// A block modified in the transient buffer has to be admitted to keep the change
+	if (index==-1 && cache->transient_block==pnum) index = cache_load(disk, cache, cache->transient_inum, pnum);
+	
+	if (index!=-1) cache_dirty_index(cache, index, offset, len);
 }
 
 void cache_fsync(DiskInterface* disk, cache *cache, uint64_t inum)
 {
+	// Snapshots of this inode taken by a running checkpoint are not on disk yet
+	for (int i=cache->checkpoint_next; i<cache->checkpoint_count; i++)
+	{
+		cache_shadow_t *shadow = &cache->checkpoint[i];
+		if (shadow->data && cache->inode_number[shadow->index]==inum) cache_shadow_write(disk, cache, shadow);
+	}
+	
 	// Look up all dirty blocks for this specific inode
 	DL_HM_LL *hmlist = dl_lookup(cache->dirty_list, inum);
-	DL_HM_LL *prev;
 	if (hmlist)
 	{
 		// Iterate through all dirty blocks for this inode
@@ -126,51 +536,279 @@ void cache_fsync(DiskInterface* disk, cache *cache, uint64_t inum)
 			int index = pci_lookup(cache->pci, list->block_number);
 			
 			// Write the dirty block back to disk
-			disk_write_block(disk, cache->cache[index].block_number, cache->cache[index].page_data);
+			cache_writeback(disk, cache, index);
 			
 			// Mark as clean since it's now synced with disk
-			cache->cache[index].dirty_bit=false;
+			cache->meta[index].dirty_bit=false;
 			
 			// Remove from dirty list
-			list = dl_pop(list);
+			list = dl_pop(list, cache->sanitize);
 			
 			// Remove from global dirty list
-			gdl_pop(cache, cache->cache[index].gdl_pos);
+			gdl_pop(cache, index);
 		}
+		hmlist->list = NULL;
 		// Remove entire inode entry from dirty list
 		dl_delete(cache->dirty_list, inum);
 	}
 }
 
-void cache_sync(DiskInterface* disk, cache *cache)
+int cache_checkpoint_begin(DiskInterface* disk, cache *cache)
 {
-	// Sync all dirty blocks to disk using global dirty list
-	GDL *curr = cache->gdl;
-	while (curr!=NULL)
+	// Finish the previous checkpoint so snapshots of a block reach disk in order
+	if (cache->checkpoint)
+	{
+		cache_checkpoint_step(disk, cache, cache->checkpoint_count);
+	}
+	if (cache->gdl_size==0) return 0;
+	
+	cache->checkpoint = malloc(cache->gdl_size * sizeof(cache_shadow_t));
+	cache->checkpoint_count = 0;
+	cache->checkpoint_next = 0;
+	
+	// Snapshot every dirty entry and mark it clean, so that a write during
+	// the checkpoint dirties the entry again instead of waiting for the flush
+	uint32_t curr = cache->gdl;
+	while (curr!=CACHE_NIL)
 	{
-		// Get cache entry index from global dirty list
-		int index = cache->gdl->index;
-		block_type_t *block_type = (block_type_t*)cache->cache[index].page_data;
+		uint32_t index = curr;
+		cache_meta_t *meta = &cache->meta[index];
+		block_type_t *block_type = (block_type_t*)cache->page_data[index];
 		
-		// Write dirty block back to disk
-		disk_write_block(disk, cache->cache[index].block_number, cache->cache[index].page_data);
+		// Take a copy of the dirty range
+		cache_shadow_t *shadow = &cache->checkpoint[cache->checkpoint_count];
+		shadow->block_number = meta->block_number;
+		shadow->index = index;
+		shadow->offset = meta->dirty_start;
+		shadow->len = meta->dirty_end - meta->dirty_start;
+		shadow->data = malloc(shadow->len);
+		memcpy(shadow->data, cache->page_data[index] + meta->dirty_start, shadow->len);
+		cache->shadow_slot[index] = cache->checkpoint_count++;
+		meta->flags |= CACHE_FLAG_FLUSHING;
 		
 		// Move to next entry before removing current one
-		curr=curr->next;
+		curr=cache->gdl_links[curr].next;
 		
 		// Remove from global dirty list
-		gdl_pop(cache, cache->gdl);
+		gdl_pop(cache, index);
 		
-		// Mark as clean and clear dirty list position
-		cache->cache[index].dirty_bit=false;
-		cache->cache[index].gdl_pos=NULL;
+		// Mark as clean
+		meta->dirty_bit=false;
+		meta->dirty_start = 0;
+		meta->dirty_end = 0;
 		
 		// Remove from per-inode dirty list if it's a data block
-		if (block_type==BLOCK_TYPE_DATA) dl_remove_block(cache->dirty_list, cache->cache[index].inode_number, cache->cache[index].block_number);
+		if (block_type==BLOCK_TYPE_DATA) dl_remove_block(cache->dirty_list, cache->inode_number[index], meta->block_number);
+	}
+	return cache->checkpoint_count;
+}
+
+int cache_checkpoint_step(DiskInterface* disk, cache *cache, int max)
+{
+	if (!cache->checkpoint) return 0;
+	
+	// Write up to max snapshots; ones already written by an eviction or fsync are skipped
+	while (max>0 && cache->checkpoint_next<cache->checkpoint_count)
+	{
+		cache_shadow_t *shadow = &cache->checkpoint[cache->checkpoint_next++];
+		if (!shadow->data) continue;
+		cache_shadow_write(disk, cache, shadow);
+		max--;
+	}
+	
+	int remaining = cache->checkpoint_count - cache->checkpoint_next;
+	if (remaining==0)
+	{
+		// Checkpoint complete
+		free(cache->checkpoint);
+		cache->checkpoint = NULL;
+		cache->checkpoint_count = 0;
+		cache->checkpoint_next = 0;
+	}
+	return remaining;
+}
+
+void cache_sync(DiskInterface* disk, cache *cache)
+{
+	// Snapshot all dirty blocks, then write the snapshots out
+	cache_checkpoint_begin(disk, cache);
+	cache_checkpoint_step(disk, cache, cache->checkpoint_count);
+}
+
+void cache_mark_sensitive(cache *cache, uint64_t inum)
+{
+	si_insert(cache->sensitive, inum);
+}
+
+/**
+ * One resident block as recorded in the warm-up sidecar file
+ */
+typedef struct warm_entry_t
+{
+	uint64_t block_number;
+	uint64_t inode_number;
+	uint64_t rank;               // Position in LRU order, 0 = most recently used
+	int index;                   // Cache entry the block was loaded into
+} warm_entry_t;
+
+#define WARM_MAGIC 0x4d524157    // "WARM"
+
+static int
+warm_cmp_block(const void *a, const void *b)
+{
+	const warm_entry_t *x = a, *y = b;
+	return (x->block_number > y->block_number) - (x->block_number < y->block_number);
+}
+
+static int
+warm_cmp_rank(const void *a, const void *b)
+{
+	const warm_entry_t *x = a, *y = b;
+	return (x->rank < y->rank) - (x->rank > y->rank);
+}
+
+int cache_save_hot_set(cache *cache, const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	if (!fp) return -1;
+	
+	uint32_t magic = WARM_MAGIC;
+	uint64_t count = cache->lru_size;
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(&count, sizeof(count), 1, fp);
+	
+	// Walk the LRU list from the head (most recent) towards the tail
+	uint32_t curr = cache->lru;
+	for (uint64_t i=0; i<count; i++)
+	{
+		uint64_t rec[2] = { cache->meta[curr].block_number, cache->inode_number[curr] };
+		fwrite(rec, sizeof(rec), 1, fp);
+		curr = cache->lru_links[curr].next;
+	}
+	
+	fclose(fp);
+	return count;
+}
+
+int cache_warm(DiskInterface* disk, cache *cache, const char *path)
+{
+	// Remember where to save the hot set on shutdown
+	free(cache->warm_path);
+	cache->warm_path = strdup(path);
+	
+	FILE *fp = fopen(path, "rb");
+	if (!fp) return -1;
+	
+	uint32_t magic;
+	uint64_t count;
+	if (fread(&magic, sizeof(magic), 1, fp)!=1 || magic!=WARM_MAGIC || fread(&count, sizeof(count), 1, fp)!=1)
+	{
+		fclose(fp);
+		return -1;
+	}
+	
+	// Only the hottest blocks that fit in the free slots are worth loading
+	count = MIN(count, (uint64_t)(cache->cache_size - cache->lru_size));
+	warm_entry_t *entries = malloc(count * sizeof(warm_entry_t));
+	uint64_t n = 0;
+	for (uint64_t i=0; i<count; i++)
+	{
+		uint64_t rec[2];
+		if (fread(rec, sizeof(rec), 1, fp)!=1) break;
+		if (rec[0] >= disk->total_blocks || pci_lookup(cache->pci, rec[0])!=-1) continue;
+		entries[n].block_number = rec[0];
+		entries[n].inode_number = rec[1];
+		entries[n].rank = i;
+		n++;
+	}
+	fclose(fp);
+	
+	// Read in sorted block order, hinting each contiguous run in one go
+	qsort(entries, n, sizeof(warm_entry_t), warm_cmp_block);
+	for (uint64_t i=0; i<n; )
+	{
+		uint64_t run = 1;
+		while (i+run<n && entries[i+run].block_number==entries[i].block_number+run) run++;
+		disk_prefetch(disk, entries[i].block_number, run);
+		for (uint64_t j=i; j<i+run; j++)
+		{
+			entries[j].index = cache_install(disk, cache, entries[j].inode_number, entries[j].block_number);
+			disk_read_block(disk, entries[j].block_number, cache->page_data[entries[j].index]);
+		}
+		i += run;
+	}
+	
+	// Restore recency: touch from coldest to hottest so the hottest ends at the head
+	qsort(entries, n, sizeof(warm_entry_t), warm_cmp_rank);
+	for (uint64_t i=0; i<n; i++)
+	{
+		cache_touch(cache, entries[i].index);
+	}
+	
+	free(entries);
+	return n;
+}
+
+void cache_enable_admission(cache *cache)
+{
+	if (cache->sketch==NULL) cache->sketch = cms_create(cache->cache_size);
+}
+
+void cache_enable_ztier(cache *cache, uint64_t bytes)
+{
+	if (cache->ztier==NULL) cache->ztier = zt_create(bytes);
+}
+
+int cache_enable_l2(cache *cache, const char *path, uint64_t blocks)
+{
+	if (cache->l2) return 0;
+	cache->l2 = l2_open(path, blocks);
+	return (cache->l2==NULL) ? -1 : 0;
+}
+
+void cache_enable_reclamation(cache *cache)
+{
+	cache->ebr = ebr_create();
+	cache->ebr_tid = ebr_register(cache->ebr);
+	cache->pci->ebr = cache->ebr;
+	cache->pci->ebr_tid = cache->ebr_tid;
+}
+
+int cache_enable_async(cache *cache, DiskInterface* disk, int workers)
+{
+	cache->aio = aio_create(disk, workers);
+	return cache->aio ? 0 : -1;
+}
+
+void cache_print_stats(cache *cache)
+{
+	uint64_t lookups = cache->stats.hits + cache->stats.misses;
+	printf("L1: %lu hits, %lu misses (%.1f%% hit ratio), %lu evictions, %lu writebacks, %lu rejected by admission\n",
+		cache->stats.hits, cache->stats.misses, lookups ? 100.0 * cache->stats.hits / lookups : 0.0,
+		cache->stats.evictions, cache->stats.writebacks, cache->stats.rejected);
+	if (cache->aio)
+	{
+		printf("Async: %lu misses coalesced, %d reads in flight, %d workers\n",
+			cache->stats.coalesced, cache->pending_count, cache->aio->worker_count);
+	}
+	if (cache->ztier)
+	{
+		ZT_Stats *zs = &cache->ztier->stats;
+		printf("ZT: %lu hits, %lu misses, %lu stored (%.1fx compression), %lu incompressible, %lu/%lu slab bytes used\n",
+			zs->hits, zs->misses, zs->stores, zs->bytes_out ? (double)zs->bytes_in / zs->bytes_out : 0.0,
+			zs->incompressible, cache->ztier->used, cache->ztier->size);
+	}
+	if (cache->l2)
+	{
+		L2_Stats *ls = &cache->l2->stats;
+		uint64_t l2_lookups = ls->hits + ls->misses;
+		printf("L2: %lu hits, %lu misses (%.1f%% hit ratio), %lu writes, %lu invalidations, %lu slots\n",
+			ls->hits, ls->misses, l2_lookups ? 100.0 * ls->hits / l2_lookups : 0.0,
+			ls->writes, ls->invalidations, cache->l2->slots);
 	}
 }
 
-cache* alloc_cache()
+cache* alloc_cache(sanitize_policy_t policy)
 {
 	// Determine cache size based on available system memory
 	struct sysinfo info;
@@ -186,20 +824,54 @@ cache* alloc_cache()
 	// Allocate main cache structure
 	cache *cache = malloc(sizeof(struct cache));
 	cache->cache_size = cache_size;
+	cache->sanitize = policy;
+	cache->warm_path = NULL;
+	memset(&cache->stats, 0, sizeof(cache->stats));
 	
-	// Allocate array of cache entries
-	cache->cache = malloc(cache_size * sizeof(struct cache_entry_t));
+	// Admission filtering is off until cache_enable_admission is called
+	cache->sketch = NULL;
+	cache->transient = malloc(BLOCK_SIZE);
+	cache->transient_block = CACHE_NO_BLOCK;
+	cache->transient_inum = 0;
 	
-	// Initialize all cache entries - clear page data pointers
-	for (int i=0; i<cache->cache_size; i++)
+	// No compressed tier until cache_enable_ztier is called
+	cache->ztier = NULL;
+	
+	// No L2 log file until cache_enable_l2 is called
+	cache->l2 = NULL;
+	
+	// get_block_async reads synchronously until cache_enable_async is called
+	cache->aio = NULL;
+	cache->pending_count = 0;
+	for (int i=0; i<HASHMAP_SIZE; i++)
 	{
-		cache->cache[i].page_data=NULL;
-		cache->cache[i].lru_pos=NULL;
+		cache->pending[i] = NULL;
 	}
-	// Initialize all entries as clean
+	
+	// Pages and index nodes are freed immediately until cache_enable_reclamation is called
+	cache->ebr = NULL;
+	
+	// No checkpoint in progress
+	cache->checkpoint = NULL;
+	cache->checkpoint_count = 0;
+	cache->checkpoint_next = 0;
+	
+	// Allocate the parallel arrays of cache entries
+	cache->meta = calloc(cache_size, sizeof(cache_meta_t));
+	cache->lru_links = malloc(cache_size * sizeof(LRU_Link));
+	cache->gdl_links = malloc(cache_size * sizeof(GDL_Link));
+	cache->inode_number = calloc(cache_size, sizeof(uint64_t));
+	cache->page_data = calloc(cache_size, sizeof(void*));
+	cache->free_stack = malloc(cache_size * sizeof(uint32_t));
+	cache->shadow_slot = malloc(cache_size * sizeof(uint32_t));
+	
+	// Initialize all entries as unlinked; calloc leaves them clean with no page data
 	for (int i=0; i<cache_size; i++)
 	{
-		cache->cache[i].dirty_bit = false;
+		cache->lru_links[i].next = CACHE_NIL;
+		cache->lru_links[i].prev = CACHE_NIL;
+		cache->gdl_links[i].next = CACHE_NIL;
+		cache->gdl_links[i].prev = CACHE_NIL;
 	}
 	
 	// Initialize list sizes
@@ -212,6 +884,7 @@ cache* alloc_cache()
 	{
 		cache->pci->HashMap[i] = NULL;
 	}
+	cache->pci->ebr = NULL;
 	
 	// Allocate and initialize dirty list hashmap
 	cache->dirty_list = malloc(sizeof(struct DL_HM));
@@ -219,39 +892,44 @@ cache* alloc_cache()
 	{
 		cache->dirty_list->HashMap[i] = NULL;
 	}
+	cache->dirty_list->sanitize = policy;
+	
+	// Allocate and initialize the sensitive inode set
+	cache->sensitive = malloc(sizeof(struct SI_HM));
+	for (int i=0; i<HASHMAP_SIZE; i++)
+	{
+		cache->sensitive->HashMap[i] = NULL;
+	}
 	
-	// Initialize free list with all cache slots
-	cache->free_list=NULL;
-	for (int i=0; i<cache_size; i++) {
-		printf("Pushing cache index %d to free list.\n", i);
-		cache->free_list = fl_push(cache->free_list, i);
+	// Initialize free stack with all cache slots, lowest index on top
+	cache->free_count = 0;
+	for (int i=cache_size-1; i>=0; i--) {
+		fl_push(cache, i);
 	}
 	
 	// Initialize LRU and global dirty lists as empty
-	cache->lru=NULL;
-	cache->gdl=NULL;
+	cache->lru=CACHE_NIL;
+	cache->gdl=CACHE_NIL;
 	return cache;
 }
 
 void free_cache(cache *cache)
 {
-	// Clean up global dirty list
-	for (int i=cache->gdl_size; i>0; i--)
+	// Persist the hot set for the next run before tearing down the LRU list
+	if (cache->warm_path)
 	{
-		gdl_pop(cache, cache->gdl);
+		cache_save_hot_set(cache, cache->warm_path);
+		free(cache->warm_path);
 	}
 	
-	// Clean up LRU list
-	for (int i=cache->lru_size; i>0; i--)
+	// Run the deferred frees while the cache they refer to still exists
+	// Anything they release from here on is freed immediately
+	if (cache->ebr)
 	{
-		lru_pop(cache, cache->lru);
-	}
-	
-	// Clean up free list
-	while (cache->free_list!=NULL)
-	{
-		printf("Popping cache index %d from free list.\n", cache->free_list->index);
-		cache->free_list = fl_pop(cache->free_list);
+		EBR *ebr = cache->ebr;
+		cache->ebr = NULL;
+		cache->pci->ebr = NULL;
+		ebr_destroy(ebr);
 	}
 	
 	// Clean up dirty list hashmap - free all chains
@@ -266,16 +944,15 @@ void free_cache(cache *cache)
 			DL_LL *list = hmlist->list;
 			while (list)
 			{
-				list = dl_pop(list);
+				list = dl_pop(list, cache->sanitize);
 				hmlist->list = list;
 			}
 			hmlist = hmlist->next;
-			// Securely clear memory before freeing
-			arc4random_buf(prev, sizeof(struct DL_HM_LL));
+			sanitize(cache->sanitize, prev, sizeof(struct DL_HM_LL));
 			free(prev);
 		}
 	}
-	arc4random_buf(cache->dirty_list, sizeof(struct DL_HM));
+	sanitize(cache->sanitize, cache->dirty_list, sizeof(struct DL_HM));
 	free(cache->dirty_list);
 	
 	// Clean up primary cache index hashmap - free all chains
@@ -286,28 +963,66 @@ void free_cache(cache *cache)
 		{
 			prev = cache->pci->HashMap[i];
 			cache->pci->HashMap[i] = cache->pci->HashMap[i]->next;
-			// Securely clear memory before freeing
-			arc4random_buf(prev, sizeof(struct PCI_LL));
+			sanitize(cache->sanitize, prev, sizeof(struct PCI_LL));
 			free(prev);
 		}
 	}
-	arc4random_buf(cache->pci, sizeof(struct PCI_HM));
+	sanitize(cache->sanitize, cache->pci, sizeof(struct PCI_HM));
 	free(cache->pci);
 	
+	// Drop the snapshots of an unfinished checkpoint
+	if (cache->checkpoint)
+	{
+		for (int i=cache->checkpoint_next; i<cache->checkpoint_count; i++)
+		{
+			if (cache->checkpoint[i].data) cache_shadow_release(cache, &cache->checkpoint[i]);
+		}
+		free(cache->checkpoint);
+	}
+	
 	// Free all cached page data
 	for (int i=0; i<cache->cache_size; i++)
 	{
-		if (cache->cache[i].page_data)
+		if (cache->page_data[i]) cache_free_page(cache, i);
+	}
+	
+	// Free the admission filter and its transient buffer
+	if (cache->sketch) cms_free(cache->sketch);
+	sanitize(cache->sanitize, cache->transient, BLOCK_SIZE);
+	free(cache->transient);
+	
+	// Stop the readers and drop the misses still in flight
+	if (cache->aio)
+	{
+		aio_destroy(cache->aio);
+		for (int i=0; i<HASHMAP_SIZE; i++)
 		{
-			// Securely clear cached data before freeing
-			arc4random_buf(cache->cache[i].page_data, BLOCK_SIZE);
-			free(cache->cache[i].page_data);
+			while (cache->pending[i])
+			{
+				CACHE_Pending *pending = cache->pending[i];
+				cache->pending[i] = pending->next;
+				cache_pending_free(cache, pending);
+			}
 		}
 	}
 	
-	// Free cache entries array and main cache structure
-	arc4random_buf(cache->cache, cache->cache_size * sizeof(struct cache_entry_t));
-	free(cache->cache);
-	arc4random_buf(cache, sizeof(struct cache));
+	if (cache->ztier) zt_free(cache->ztier);
+	if (cache->l2) l2_close(cache->l2);
+	
+	// Free the sensitive inode set
+	si_clear(cache->sensitive);
+	free(cache->sensitive);
+	
+	// Free the cache entry arrays and main cache structure
+	sanitize(cache->sanitize, cache->meta, cache->cache_size * sizeof(cache_meta_t));
+	sanitize(cache->sanitize, cache->inode_number, cache->cache_size * sizeof(uint64_t));
+	free(cache->meta);
+	free(cache->lru_links);
+	free(cache->gdl_links);
+	free(cache->inode_number);
+	free(cache->page_data);
+	free(cache->free_stack);
+	free(cache->shadow_slot);
+	sanitize(cache->sanitize, cache, sizeof(struct cache));
 	free(cache);
 }
@@ -9,27 +9,71 @@
 
 /* In this case, we push to the head of the list and pop from the tail.
  * In the other case we can push and pop from the head. */
-LRU_List *lru_push(cache *cache, int index);
-int64_t lru_pop(cache *cache, LRU_List *list);
+void lru_push(cache *cache, uint32_t index);
+uint32_t lru_pop(cache *cache);
+void lru_remove(cache *cache, uint32_t index);
+void lru_touch(cache *cache, uint32_t index);
 
 /* In this case, we push to the head of the list, and pop from
  * wherever in the list the given node is placed.
  */
-GDL *gdl_push(cache *cache, int index);
-void gdl_pop(cache *cache, GDL *list);
+void gdl_push(cache *cache, uint32_t index);
+void gdl_pop(cache *cache, uint32_t index);
+
+/* The free list is a stack of unused entry indices. */
+void fl_push(cache *cache, uint32_t index);
+uint32_t fl_pop(cache *cache);
 
 /**
  * Retrieve a block from cache, loading from disk if necessary
+ * With admission enabled, a block that loses to the LRU victim is served
+ * from a transient buffer that stays valid until the next miss
  */
 void*
 get_block(DiskInterface* disk, cache *cache, uint64_t inum, uint64_t pnum);
 
+/**
+ * Retrieve a block without waiting for the disk
+ * A block that is already cached is passed to callback immediately.
+ * On a miss the read is queued to the worker pool and callback runs from
+ * cache_poll once the block has been installed; concurrent misses on the
+ * same block share a single read.
+ * Without cache_enable_async this is get_block followed by the callback.
+ * @return 1 if callback has already run, 0 if it will run from cache_poll
+ */
+int
+get_block_async(DiskInterface* disk, cache *cache, uint64_t inum, uint64_t pnum, cache_callback_t callback, void *ctx);
+
+/**
+ * Install the blocks whose asynchronous reads have finished and run
+ * their callbacks, on the calling (cache owner) thread
+ * @param wait Block until at least one read finishes if none has yet
+ * @return Number of reads completed
+ */
+int cache_poll(DiskInterface* disk, cache *cache, bool wait);
+
 /**
  * Write data to a cached block, marking it dirty
+ * buf must hold a full BLOCK_SIZE page; on a miss the old contents
+ * are not read from disk since they are overwritten entirely
  */
 void
 write_block(DiskInterface* disk, cache *cache, void *buf, uint64_t inum, uint64_t pnum);
 
+/**
+ * Write len bytes of buf at offset within a cached block
+ * Only the touched bytes are copied and marked dirty for writeback
+ */
+void
+write_block_range(DiskInterface* disk, cache *cache, const void *buf, uint64_t inum, uint64_t pnum, uint32_t offset, uint32_t len);
+
+/**
+ * Mark bytes of a resident block dirty after modifying it in place
+ * through the pointer returned by get_block
+ */
+void
+cache_mark_dirty(DiskInterface* disk, cache *cache, uint64_t pnum, uint32_t offset, uint32_t len);
+
 /**
  * Sync all dirty blocks for a specific inode to disk
  */
@@ -37,14 +81,95 @@ void cache_fsync(DiskInterface* disk, cache *cache, uint64_t inum);
 
 /**
  * Sync all dirty blocks in the cache to disk
+ * Runs a whole checkpoint: cache_checkpoint_begin followed by every step
  */
 void cache_sync(DiskInterface* disk, cache *cache);
 
+/**
+ * Start a checkpoint by snapshotting the dirty range of every dirty block
+ * The blocks are marked clean immediately, so writes made while the
+ * checkpoint runs dirty them again without waiting for the disk.
+ * An unfinished previous checkpoint is completed first.
+ * @return Number of snapshots to write
+ */
+int cache_checkpoint_begin(DiskInterface* disk, cache *cache);
+
+/**
+ * Write up to max snapshots of the running checkpoint to disk
+ * @return Number of snapshots still pending (0 once the checkpoint is done)
+ */
+int cache_checkpoint_step(DiskInterface* disk, cache *cache, int max);
+
+/**
+ * Mark an inode sensitive so its cached pages are overwritten with
+ * random bytes when they leave the cache
+ */
+void cache_mark_sensitive(cache *cache, uint64_t inum);
+
+/**
+ * Save the resident block numbers to a sidecar file in LRU order,
+ * most recently used first
+ * @return Number of blocks saved, or -1 on failure
+ */
+int cache_save_hot_set(cache *cache, const char *path);
+
+/**
+ * Prefetch the hot set saved by a previous run and remember the sidecar
+ * path so free_cache saves the hot set there again on shutdown
+ * Blocks are read in sorted block order, then ranked back into LRU order
+ * @return Number of blocks loaded, or -1 if there was nothing to load
+ */
+int cache_warm(DiskInterface* disk, cache *cache, const char *path);
+
+/**
+ * Put a TinyLFU admission filter in front of the cache
+ * Misses only evict the LRU victim if they are accessed more often
+ */
+void cache_enable_admission(cache *cache);
+
+/**
+ * Keep evicted pages compressed in memory below the cache
+ * @param bytes Size of the compressed slab in bytes
+ */
+void cache_enable_ztier(cache *cache, uint64_t bytes);
+
+/**
+ * Keep clean evicted pages in a circular log file on local storage
+ * Misses read from it before falling back to the disk image
+ * @param path Path of the log file
+ * @param blocks Number of blocks the log holds
+ * @return 0 on success, -1 if the log file can't be created
+ */
+int cache_enable_l2(cache *cache, const char *path, uint64_t blocks);
+
+/**
+ * Defer freeing evicted pages, removed index nodes and freed B-tree blocks
+ * with epoch-based reclamation
+ * This is groundwork only: get_block and pci_lookup update the LRU list,
+ * the index and the sketch without locking, so no lookup can run beside the
+ * owner yet and nothing calls ebr_enter/ebr_exit. The thread that owns the
+ * cache is registered as cache->ebr_tid.
+ */
+void cache_enable_reclamation(cache *cache);
+
+/**
+ * Serve get_block_async misses from a pool of worker threads
+ * @param workers Number of reader threads
+ * @return 0 on success, -1 if no worker thread could be started
+ */
+int cache_enable_async(cache *cache, DiskInterface* disk, int workers);
+
+/**
+ * Print hit, miss and eviction counters for every cache tier
+ */
+void cache_print_stats(cache *cache);
+
 /**
  * Allocate and initialize a new cache structure
+ * @param policy How freed cache memory is cleared
  */
 cache*
-alloc_cache();
+alloc_cache(sanitize_policy_t policy);
 
 /**
  * Free all memory associated with a cache structure
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cms.h"
+
+// Per-row seeds so each row hashes a block to an independent column
+static const uint64_t cms_seeds[CMS_DEPTH] = {
+	0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL, 0xd6e8feb86659fd93ULL
+};
+
+// Mix a block number with a row seed (splitmix64 finalizer)
+static uint64_t cms_hash(uint64_t block_number, int row)
+{
+	uint64_t x = block_number + cms_seeds[row];
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// Create a sketch with at least one counter per cache entry in each row
+// Aging runs every ten cache-sizes worth of accesses, as in TinyLFU
+CMS *cms_create(uint64_t entries)
+{
+	CMS *sketch = malloc(sizeof(CMS));
+	sketch->width = 64;
+	while (sketch->width < entries) sketch->width <<= 1;
+	sketch->additions = 0;
+	sketch->sample_size = 10 * sketch->width;
+	sketch->counters = calloc(CMS_DEPTH * sketch->width, sizeof(uint8_t));
+	return sketch;
+}
+
+// Halve every counter so old popularity fades out
+static void cms_age(CMS *sketch)
+{
+	for (uint64_t i=0; i<CMS_DEPTH * sketch->width; i++)
+	{
+		sketch->counters[i] >>= 1;
+	}
+	sketch->additions /= 2;
+}
+
+// Record an access by bumping the block's counter in every row
+void cms_increment(CMS *sketch, uint64_t block_number)
+{
+	for (int row=0; row<CMS_DEPTH; row++)
+	{
+		uint8_t *counter = &sketch->counters[row * sketch->width + (cms_hash(block_number, row) & (sketch->width - 1))];
+		if (*counter < CMS_MAX_COUNT) (*counter)++;
+	}
+	
+	if (++sketch->additions >= sketch->sample_size) cms_age(sketch);
+}
+
+// The estimate is the smallest counter, which bounds collisions from other blocks
+uint8_t cms_estimate(CMS *sketch, uint64_t block_number)
+{
+	uint8_t min = CMS_MAX_COUNT;
+	for (int row=0; row<CMS_DEPTH; row++)
+	{
+		uint8_t counter = sketch->counters[row * sketch->width + (cms_hash(block_number, row) & (sketch->width - 1))];
+		if (counter < min) min = counter;
+	}
+	return min;
+}
+
+void cms_free(CMS *sketch)
+{
+	free(sketch->counters);
+	free(sketch);
+}
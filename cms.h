@@ -0,0 +1,38 @@
+#ifndef CMS_H
+#define CMS_H
+#include <stdint.h>
+
+/*=== Count-Min Sketch (TinyLFU frequency filter) ===*/
+
+#define CMS_DEPTH 4              // Number of hash rows
+#define CMS_MAX_COUNT 15         // Counters saturate like 4-bit TinyLFU counters
+
+typedef struct CMS
+{
+	uint64_t width;              // Counters per row (power of two)
+	uint64_t additions;          // Increments since the last aging pass
+	uint64_t sample_size;        // Increments between aging passes
+	uint8_t *counters;           // CMS_DEPTH rows of width counters
+} CMS;
+
+/**
+ * Create a sketch sized for a cache of the given number of entries
+ * @param entries Number of cache entries the sketch fronts
+ * @return Pointer to newly allocated sketch
+ */
+CMS *cms_create(uint64_t entries);
+
+/**
+ * Record one access to a block
+ * Halves every counter once sample_size accesses have been recorded
+ */
+void cms_increment(CMS *sketch, uint64_t block_number);
+
+/**
+ * Estimate how often a block has been accessed recently
+ */
+uint8_t cms_estimate(CMS *sketch, uint64_t block_number);
+
+void cms_free(CMS *sketch);
+
+#endif
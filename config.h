@@ -52,7 +52,113 @@ typedef enum {
  */
 #define MIN_KEYS (MAX_KEYS / 2)
 
+/**
+ * Keys below which a B-tree node is rebalanced after a delete
+ * Splits still leave nodes at least MIN_KEYS full, but deletes only
+ * borrow or merge once a node falls this far, so a delete that leaves
+ * a node between the two marks costs no sibling reads or writes
+ */
+#define BTREE_LOW_WATER (MIN_KEYS / 2)
+
+/**
+ * Percentage of children the left half keeps when a node on the right
+ * edge of the tree splits
+ * Keys inserted in increasing order never land in the left half again,
+ * so it is left nearly full instead of half empty
+ */
+#define BTREE_APPEND_SPLIT 90
+
+/**
+ * Slots for trees whose rightmost leaf is remembered for fast appends
+ * A tree whose slot holds another tree's hint appends with a descent.
+ */
+#define BTREE_HINTS 16
+
+/**
+ * Hash buckets for the Bloom filters attached to trees
+ */
+#define BTREE_FILTERS 16
+
+/**
+ * Deletes, as a percentage of the keys added, after which a tree's Bloom
+ * filter is rebuilt by its next lookup
+ */
+#define BTREE_FILTER_REBUILD_PERCENT 25
+
+/**
+ * Hash buckets for the trees whose upper levels are routed in memory
+ */
+#define BTREE_ROUTES 16
+
+/**
+ * Number of upper tree levels mirrored into the in-memory routing table,
+ * and the most nodes it may hold
+ */
+#define BTREE_ROUTE_LEVELS 3
+#define BTREE_ROUTE_MAX_NODES 1024
+
+/**
+ * Hash buckets for the directory entry caches of path indexes
+ */
+#define BTREE_DCACHES 16
+
+/**
+ * Hash buckets for the memtables in front of trees
+ */
+#define BTREE_MEMTABLES 16
+
+/**
+ * Deepest B-tree a descent path can record
+ * Deletes only rebalance a non-root node once it has fewer than
+ * BTREE_LOW_WATER+1 children, so reaching this depth takes about
+ * (BTREE_LOW_WATER+1)^(BTREE_MAX_DEPTH-1) leaves, 2^47 with the defaults.
+ * Copy-on-write deletes don't rebalance and can leave nodes with a single
+ * child, so there the depth is only bounded by the root splits that grew it.
+ */
+#define BTREE_MAX_DEPTH 48
+
 #define HASHMAP_SIZE 32
 
+// ==================== COMPRESSED TIER CONFIGURATION ====================
+
+/**
+ * Buckets in the compressed tier's index
+ * The tier holds many more pages than the cache, so it gets a wider table
+ */
+#define ZT_HASHMAP_SIZE 1024
+
+/**
+ * Largest compressed size worth keeping, in eighths of a block
+ * Pages that compress worse than this are cheaper to re-read from disk
+ */
+#define ZT_MAX_RATIO 6
+
+// ==================== L2 CACHE CONFIGURATION ====================
+
+/**
+ * Buckets in the L2 log file's index
+ */
+#define L2_HASHMAP_SIZE 1024
+
+// ==================== EPOCH RECLAMATION CONFIGURATION ====================
+
+/**
+ * Maximum number of threads that can read the cache and B-tree at once
+ */
+#define EBR_MAX_THREADS 64
+
+/**
+ * Retirements a thread makes between attempts to advance the epoch
+ * and reclaim its deferred free lists
+ */
+#define EBR_COLLECT_INTERVAL 64
+
+// ==================== ASYNCHRONOUS READ CONFIGURATION ====================
+
+/**
+ * Largest number of worker threads reading blocks for get_block_async
+ */
+#define AIO_MAX_WORKERS 16
+
 #endif
 
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dcache.h"
+
+DCache *dcache_create(uint32_t entries)
+{
+	DCache *dcache = malloc(sizeof(DCache));
+	dcache->size = entries ? entries : 1;
+	dcache->used = 0;
+	dcache->hand = 0;
+	dcache->buckets = 64;
+	while (dcache->buckets < dcache->size) dcache->buckets <<= 1;
+	dcache->heads = malloc(dcache->buckets * sizeof(uint32_t));
+	for (uint32_t i=0; i<dcache->buckets; i++) dcache->heads[i] = DCACHE_NIL;
+	dcache->entries = calloc(dcache->size, sizeof(DCache_Entry));
+	dcache->hits = 0;
+	dcache->negative_hits = 0;
+	dcache->misses = 0;
+	return dcache;
+}
+
+// Index of the entry for a path, or DCACHE_NIL
+static uint32_t dcache_find(DCache *dcache, uint64_t hash, const char *path, size_t len)
+{
+	uint32_t index = dcache->heads[hash & (dcache->buckets - 1)];
+	while (index != DCACHE_NIL)
+	{
+		DCache_Entry *entry = &dcache->entries[index];
+		if (entry->hash == hash && entry->len == len && memcmp(entry->path, path, len) == 0) return index;
+		index = entry->next;
+	}
+	return DCACHE_NIL;
+}
+
+// Unlink an entry from its bucket and free its path
+static void dcache_remove(DCache *dcache, uint32_t index)
+{
+	DCache_Entry *entry = &dcache->entries[index];
+	uint32_t *link = &dcache->heads[entry->hash & (dcache->buckets - 1)];
+	while (*link != index) link = &dcache->entries[*link].next;
+	*link = entry->next;
+	
+	free(entry->path);
+	memset(entry, 0, sizeof(DCache_Entry));
+	dcache->used--;
+}
+
+// Advance the clock hand to an entry that hasn't been used since its last pass
+static uint32_t dcache_victim(DCache *dcache)
+{
+	while (true)
+	{
+		uint32_t index = dcache->hand;
+		DCache_Entry *entry = &dcache->entries[index];
+		dcache->hand = (dcache->hand + 1) % dcache->size;
+		
+		if (entry->path == NULL) return index;
+		if (!entry->referenced)
+		{
+			dcache_remove(dcache, index);
+			return index;
+		}
+		entry->referenced = false;
+	}
+}
+
+int dcache_lookup(DCache *dcache, uint64_t hash, const char *path, size_t len, uint64_t *inum)
+{
+	uint32_t index = dcache_find(dcache, hash, path, len);
+	if (index == DCACHE_NIL)
+	{
+		dcache->misses++;
+		return -1;
+	}
+	
+	DCache_Entry *entry = &dcache->entries[index];
+	entry->referenced = true;
+	if (entry->negative)
+	{
+		dcache->negative_hits++;
+		return 0;
+	}
+	dcache->hits++;
+	*inum = entry->inum;
+	return 1;
+}
+
+void dcache_insert(DCache *dcache, uint64_t hash, const char *path, size_t len, uint64_t inum, bool negative)
+{
+	uint32_t index = dcache_find(dcache, hash, path, len);
+	if (index == DCACHE_NIL)
+	{
+		index = dcache_victim(dcache);
+		DCache_Entry *entry = &dcache->entries[index];
+		entry->hash = hash;
+		entry->path = malloc(len ? len : 1);
+		memcpy(entry->path, path, len);
+		entry->len = len;
+		entry->next = dcache->heads[hash & (dcache->buckets - 1)];
+		dcache->heads[hash & (dcache->buckets - 1)] = index;
+		dcache->used++;
+	}
+	
+	DCache_Entry *entry = &dcache->entries[index];
+	entry->negative = negative;
+	entry->inum = negative ? 0 : inum;
+	entry->referenced = true;
+}
+
+void dcache_invalidate(DCache *dcache, uint64_t hash, const char *path, size_t len)
+{
+	uint32_t index = dcache_find(dcache, hash, path, len);
+	if (index != DCACHE_NIL) dcache_remove(dcache, index);
+}
+
+void dcache_free(DCache *dcache)
+{
+	for (uint32_t i=0; i<dcache->size; i++) free(dcache->entries[i].path);
+	free(dcache->entries);
+	free(dcache->heads);
+	free(dcache);
+}
@@ -0,0 +1,67 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*=== Directory entry cache (path -> inode number) ===*/
+
+#define DCACHE_NIL UINT32_MAX    // Ends a bucket chain
+
+/**
+ * One cached path resolution
+ * A negative entry records that the path doesn't exist
+ */
+typedef struct DCache_Entry
+{
+	uint64_t hash;               // path_hash of the path (0 if the entry is unused)
+	char *path;                  // Full path, to tell apart paths with the same hash
+	uint16_t len;                // Length of path
+	bool negative;               // Path is known not to exist
+	bool referenced;             // Used since the clock hand last passed
+	uint64_t inum;               // Inode number (positive entries only)
+	uint32_t next;               // Next entry in the same bucket
+} DCache_Entry;
+
+typedef struct DCache
+{
+	uint32_t size;               // Number of entries
+	uint32_t used;               // Entries in use
+	uint32_t hand;               // Clock hand: next entry considered for eviction
+	uint32_t buckets;            // Number of hash buckets (power of two)
+	uint32_t *heads;             // First entry of each bucket (DCACHE_NIL if empty)
+	DCache_Entry *entries;
+	uint64_t hits;               // Lookups answered by a positive entry
+	uint64_t negative_hits;      // Lookups answered by a negative entry
+	uint64_t misses;             // Lookups the cache couldn't answer
+} DCache;
+
+/**
+ * Create an empty cache of at most entries paths
+ * @return Pointer to newly allocated cache
+ */
+DCache *dcache_create(uint32_t entries);
+
+/**
+ * Look up a path
+ * @param hash path_hash of path
+ * @param inum Filled with the inode number on a positive hit
+ * @return 1 on a positive hit, 0 on a negative hit, -1 on a miss
+ */
+int dcache_lookup(DCache *dcache, uint64_t hash, const char *path, size_t len, uint64_t *inum);
+
+/**
+ * Record the result of resolving a path, replacing any entry for it
+ * The least recently used entry, as approximated by CLOCK, makes room
+ * @param negative Path doesn't exist (inum is ignored)
+ */
+void dcache_insert(DCache *dcache, uint64_t hash, const char *path, size_t len, uint64_t inum, bool negative);
+
+/**
+ * Drop the entry for a path, if any
+ */
+void dcache_invalidate(DCache *dcache, uint64_t hash, const char *path, size_t len);
+
+void dcache_free(DCache *dcache);
+
+#endif
@@ -5,6 +5,7 @@
 #include <sys/mman.h>
 #include <assert.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "disk.h"
 #include "config.h"
@@ -125,12 +126,8 @@ alloc_page(DiskInterface* disk, cache *cache)
 		if (!bitmap_get(pbm, ii)) {  // Found a free block
 			bitmap_put(pbm, ii, 1);  // Mark it as allocated
 			#ifndef CACHE_DISABLED
-			int index = pci_lookup(cache->pci, 0);
-			cache->cache[index].dirty_bit=true;
-			
-			// Add to global dirty list for sync operations
-			cache->gdl = gdl_push(cache, index);
-			cache->cache[index].gdl_pos = cache->gdl;
+			// Only the bitmap word holding this bit needs writing back
+			cache_mark_dirty(disk, cache, 0, (ii / 64) * sizeof(uint64_t), sizeof(uint64_t));
 			#endif
 			printf("+ alloc_page() -> %d\n", ii);
 			return ii;
@@ -152,14 +149,14 @@ free_page(DiskInterface* disk, cache *cache, int pnum)
 	void* pbm = disk_get_block_bitmap(disk);
 	#else
 	void* pbm = get_block(disk, cache, 0, 0);	// TODO: Change the block bitmap numbers later after integration with superblock/direntries/inodes
-	int index = pci_lookup(cache->pci, 0);
-	cache->cache[index].dirty_bit=true;
-	
-	// Add to global dirty list for sync operations
-	cache->gdl = gdl_push(cache, index);
-	cache->cache[index].gdl_pos = cache->gdl;
 	#endif
 	bitmap_put(pbm, pnum, 0);  // Mark block as free
+	#ifndef CACHE_DISABLED
+	// Only the bitmap word holding this bit needs writing back. The bitmap
+	// may sit in the transient buffer, which marking it dirty copies into
+	// the cache, so the bit has to be cleared first.
+	cache_mark_dirty(disk, cache, 0, (pnum / 64) * sizeof(uint64_t), sizeof(uint64_t));
+	#endif
 }
 
 /**
@@ -196,6 +193,35 @@ int disk_write_block(DiskInterface* disk, uint64_t block_num, const void* buffer
 	return rv;
 }
 
+/**
+ * Write part of a block on disk from a buffer
+ * Lets the cache write back only the bytes that were modified
+ */
+int disk_write_range(DiskInterface* disk, uint64_t block_num, uint32_t offset, uint32_t len, const void* buffer)
+{
+	int rv = -1;
+	if (offset + len > BLOCK_SIZE) return rv;
+	void *block = disk_get_block(disk, block_num);
+	
+	// Copy the modified bytes to their location in the block
+	if (memcpy(block + offset, buffer, len)) {
+		rv = 0;
+	}
+	
+	return rv;
+}
+
+/**
+ * Hint that a run of blocks will be read soon
+ * Lets the kernel page in the whole run with one large read
+ */
+void disk_prefetch(DiskInterface* disk, uint64_t block_num, uint64_t count)
+{
+	if (block_num >= disk->total_blocks) return;
+	count = MIN(count, disk->total_blocks - block_num);
+	madvise(disk_get_block(disk, block_num), count * BLOCK_SIZE, MADV_WILLNEED);
+}
+
 /**
  * Format the disk with a new filesystem
  * TODO: Implement filesystem formatting functionality
@@ -92,6 +92,25 @@ int disk_read_block(DiskInterface* disk, uint64_t block_num, void* buffer);
  */
 int disk_write_block(DiskInterface* disk, uint64_t block_num, const void* buffer);
 
+/**
+ * Write part of a block on disk from a buffer
+ * @param disk Pointer to DiskInterface
+ * @param block_num Block number to write
+ * @param offset Byte offset within the block
+ * @param len Number of bytes to write
+ * @param buffer Buffer containing the bytes to write
+ * @return 0 on success, -1 on failure
+ */
+int disk_write_range(DiskInterface* disk, uint64_t block_num, uint32_t offset, uint32_t len, const void* buffer);
+
+/**
+ * Hint that a run of blocks will be read soon
+ * @param disk Pointer to DiskInterface
+ * @param block_num First block of the run
+ * @param count Number of consecutive blocks
+ */
+void disk_prefetch(DiskInterface* disk, uint64_t block_num, uint64_t count);
+
 /**
  * Format the disk with a new filesystem
  * @param disk Pointer to DiskInterface
@@ -1,6 +1,5 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <bsd/stdlib.h>
 #include "dl.h"
 
 // Add a block number to a dirty list
@@ -18,14 +17,14 @@ DL_LL *dl_push(DL_LL *list, uint64_t block_number)
 }
 
 // Remove the head of a dirty list
-// Securely wipes the removed node before freeing
-DL_LL *dl_pop(DL_LL *list)
+// Sanitizes the removed node according to the cache's policy before freeing
+DL_LL *dl_pop(DL_LL *list, sanitize_policy_t policy)
 {
 	// Save pointer to new head
 	DL_LL *temp = list->next;
 	
-	// Securely overwrite node data before freeing
-	arc4random_buf(list, sizeof(struct DL_LL));
+	// Clear node data before freeing if the policy asks for it
+	sanitize(policy, list, sizeof(struct DL_LL));
 	free(list);
 	
 	return temp;
@@ -98,7 +97,7 @@ void dl_insert(DL_HM *hashmap, uint64_t inode_number, uint64_t block_number)
 void dl_delete(DL_HM *hashmap, uint64_t inode_number)
 {
 	DL_HM_LL *curr = hashmap->HashMap[inode_number % HASHMAP_SIZE];
-	DL_HM_LL *prev;
+	DL_HM_LL *prev = NULL;
 	
 	// Find the inode entry to delete
 	while (curr)
@@ -120,8 +119,8 @@ void dl_delete(DL_HM *hashmap, uint64_t inode_number)
 		// Deleting head of chain
 		hashmap->HashMap[inode_number % HASHMAP_SIZE] = curr->next;
 	}
-	// Securely overwrite node data before freeing
-	arc4random_buf(curr, sizeof(struct DL_HM_LL));
+	// Clear node data before freeing if the policy asks for it
+	sanitize(hashmap->sanitize, curr, sizeof(struct DL_HM_LL));
 	free(curr);
 }
 
@@ -149,6 +148,7 @@ void dl_remove_block(DL_HM *hashmap, uint64_t inode_number, uint64_t block_numbe
 		{
 			prev->next = curr->next;
 		}
+		sanitize(hashmap->sanitize, curr, sizeof(struct DL_LL));
 		free(curr);
 		
 		// If list is now empty, remove entire inode entry
@@ -2,6 +2,7 @@
 #define DL_H
 #include <stdint.h>
 #include "config.h"
+#include "sanitize.h"
 
 /* There is no reason in particular why our hashhap has to be the same size as our cache,
  * other than simply not having defined another macro...which we can. We should get rid of
@@ -28,9 +29,10 @@ typedef struct DL_HM_LL
 typedef struct DL_HM
 {
 	struct DL_HM_LL *HashMap[HASHMAP_SIZE];
+	sanitize_policy_t sanitize;  // Policy applied to nodes removed from this map
 } DL_HM;
 
-DL_LL *dl_pop(DL_LL *list);
+DL_LL *dl_pop(DL_LL *list, sanitize_policy_t policy);
 DL_HM_LL *dl_lookup(DL_HM *hashmap, uint64_t inode_number);
 void dl_insert(DL_HM *hashmap, uint64_t Inode_number, uint64_t block_number);
 void dl_delete(DL_HM *hashmap, uint64_t inode_number);
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include "ebr.h"
+
+// Run and free every callback on a limbo list
+static void ebr_reclaim(EBR_LL *list)
+{
+	while (list)
+	{
+		EBR_LL *next = list->next;
+		list->fn(list->ptr, list->ctx);
+		free(list);
+		list = next;
+	}
+}
+
+// Advance the global epoch if every thread in a critical section has seen it
+static void ebr_advance(EBR *ebr)
+{
+	uint64_t epoch = atomic_load(&ebr->epoch);
+	for (int i=0; i<EBR_MAX_THREADS; i++)
+	{
+		if (!atomic_load(&ebr->threads[i].registered)) continue;
+		uint64_t state = atomic_load(&ebr->threads[i].state);
+		// A reader still in an older epoch may hold objects retired two epochs ago
+		if ((state & 1) && (state >> 1)!=epoch) return;
+	}
+	// Another thread may have advanced it already, which is just as good
+	atomic_compare_exchange_strong(&ebr->epoch, &epoch, epoch + 1);
+}
+
+EBR *ebr_create(void)
+{
+	EBR *ebr = malloc(sizeof(EBR));
+	atomic_init(&ebr->epoch, EBR_EPOCHS);
+	for (int i=0; i<EBR_MAX_THREADS; i++)
+	{
+		atomic_init(&ebr->threads[i].state, 0);
+		atomic_init(&ebr->threads[i].registered, 0);
+		for (int j=0; j<EBR_EPOCHS; j++)
+		{
+			ebr->threads[i].limbo[j] = NULL;
+			ebr->threads[i].limbo_epoch[j] = 0;
+		}
+		ebr->threads[i].retired = 0;
+	}
+	return ebr;
+}
+
+int ebr_register(EBR *ebr)
+{
+	for (int i=0; i<EBR_MAX_THREADS; i++)
+	{
+		int expected = 0;
+		if (atomic_compare_exchange_strong(&ebr->threads[i].registered, &expected, 1)) return i;
+	}
+	return -1;
+}
+
+void ebr_unregister(EBR *ebr, int tid)
+{
+	EBR_Thread *thread = &ebr->threads[tid];
+	atomic_store(&thread->state, 0);
+	
+	// Wait out the readers that might still see this thread's retired objects
+	for (int j=0; j<EBR_EPOCHS; j++)
+	{
+		while (thread->limbo[j] && thread->limbo_epoch[j] + 2 > atomic_load(&ebr->epoch)) ebr_advance(ebr);
+		EBR_LL *list = thread->limbo[j];
+		thread->limbo[j] = NULL;
+		ebr_reclaim(list);
+	}
+	thread->retired = 0;
+	atomic_store(&thread->registered, 0);
+}
+
+void ebr_enter(EBR *ebr, int tid)
+{
+	atomic_store(&ebr->threads[tid].state, (atomic_load(&ebr->epoch) << 1) | 1);
+}
+
+void ebr_exit(EBR *ebr, int tid)
+{
+	atomic_store(&ebr->threads[tid].state, 0);
+}
+
+void ebr_retire(EBR *ebr, int tid, void *ptr, ebr_fn fn, void *ctx)
+{
+	EBR_Thread *thread = &ebr->threads[tid];
+	uint64_t epoch = atomic_load(&ebr->epoch);
+	int slot = epoch % EBR_EPOCHS;
+	
+	// A list left in this slot is from at least EBR_EPOCHS epochs ago and safe to reclaim.
+	// Callbacks may retire more objects, so the slot is reset before they run.
+	if (thread->limbo_epoch[slot]!=epoch)
+	{
+		EBR_LL *list = thread->limbo[slot];
+		thread->limbo[slot] = NULL;
+		thread->limbo_epoch[slot] = epoch;
+		ebr_reclaim(list);
+	}
+	
+	EBR_LL *node = malloc(sizeof(EBR_LL));
+	node->ptr = ptr;
+	node->fn = fn;
+	node->ctx = ctx;
+	node->next = thread->limbo[slot];
+	thread->limbo[slot] = node;
+	
+	if (++thread->retired >= EBR_COLLECT_INTERVAL) ebr_collect(ebr, tid);
+}
+
+void ebr_collect(EBR *ebr, int tid)
+{
+	EBR_Thread *thread = &ebr->threads[tid];
+	thread->retired = 0;
+	ebr_advance(ebr);
+	
+	uint64_t epoch = atomic_load(&ebr->epoch);
+	for (int j=0; j<EBR_EPOCHS; j++)
+	{
+		if (thread->limbo[j] && thread->limbo_epoch[j] + 2 <= epoch)
+		{
+			EBR_LL *list = thread->limbo[j];
+			thread->limbo[j] = NULL;
+			ebr_reclaim(list);
+		}
+	}
+}
+
+void ebr_destroy(EBR *ebr)
+{
+	for (int i=0; i<EBR_MAX_THREADS; i++)
+	{
+		for (int j=0; j<EBR_EPOCHS; j++)
+		{
+			EBR_LL *list = ebr->threads[i].limbo[j];
+			ebr->threads[i].limbo[j] = NULL;
+			ebr_reclaim(list);
+		}
+	}
+	free(ebr);
+}
@@ -0,0 +1,82 @@
+#ifndef EBR_H
+#define EBR_H
+#include <stdint.h>
+#include <stdatomic.h>
+#include "config.h"
+
+/*=== Epoch-Based Reclamation ===*/
+
+#define EBR_EPOCHS 3             // Retired objects are safe two epochs after retirement
+
+/**
+ * Callback that releases a retired object once no reader can hold it
+ */
+typedef void (*ebr_fn)(void *ptr, void *ctx);
+
+typedef struct EBR_LL
+{
+	void *ptr;
+	ebr_fn fn;
+	void *ctx;
+	struct EBR_LL *next;
+} EBR_LL;
+
+/**
+ * Per-thread epoch state and deferred free lists
+ */
+typedef struct EBR_Thread
+{
+	_Atomic uint64_t state;      // (observed epoch << 1) | 1 inside a critical section, 0 outside
+	_Atomic int registered;      // Slot is owned by a thread
+	EBR_LL *limbo[EBR_EPOCHS];   // Objects retired by this thread, one list per epoch
+	uint64_t limbo_epoch[EBR_EPOCHS]; // Epoch each limbo list was retired in
+	uint32_t retired;            // Retirements since the last collection
+} EBR_Thread;
+
+typedef struct EBR
+{
+	_Atomic uint64_t epoch;      // Global epoch
+	EBR_Thread threads[EBR_MAX_THREADS];
+} EBR;
+
+EBR *ebr_create(void);
+
+/**
+ * Claim a thread slot; every thread that reads or retires needs one
+ * @return Thread id to pass to the other calls, or -1 if all slots are taken
+ */
+int ebr_register(EBR *ebr);
+
+/**
+ * Give up a thread slot, reclaiming what it retired once that is safe
+ */
+void ebr_unregister(EBR *ebr, int tid);
+
+/**
+ * Enter a read-side critical section
+ * Objects reachable on entry stay valid until the matching ebr_exit
+ */
+void ebr_enter(EBR *ebr, int tid);
+
+void ebr_exit(EBR *ebr, int tid);
+
+/**
+ * Defer fn(ptr, ctx) until every thread has left the critical sections
+ * that might still see ptr
+ * The caller must already have unlinked ptr from shared structures
+ */
+void ebr_retire(EBR *ebr, int tid, void *ptr, ebr_fn fn, void *ctx);
+
+/**
+ * Try to advance the global epoch and run this thread's callbacks
+ * that have become safe
+ */
+void ebr_collect(EBR *ebr, int tid);
+
+/**
+ * Run every pending callback and free the reclamation state
+ * No thread may be inside a critical section
+ */
+void ebr_destroy(EBR *ebr);
+
+#endif
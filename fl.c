@@ -1,31 +1,14 @@
 #include <stdlib.h>
-#include "fl.h"
+#include "cache.h"
 
-// Push a new index onto the free list
-// Returns the new head of the list
-FL_LL *fl_push(FL_LL *list, int index)
+// Push an unused cache entry index onto the free stack
+void fl_push(cache *cache, uint32_t index)
 {
-	// Allocate memory for new node
-	FL_LL *node = (FL_LL*)malloc(sizeof(FL_LL));
-	node->index = index;
-	
-	// Insert at head of list
-	node->next = list;
-	
-	return node;
+	cache->free_stack[cache->free_count++] = index;
 }
 
-// Remove and return the head of the free list
-// Securely wipes the removed node before freeing
-FL_LL *fl_pop(FL_LL *list)
+// Pop an unused cache entry index off the free stack
+uint32_t fl_pop(cache *cache)
 {
-	// Save pointer to next node (new head)
-	FL_LL *temp = list->next;
-	
-	// Securely overwrite node data before freeing
-	arc4random_buf(list, sizeof(struct FL_LL));
-	free(list);
-	
-	return temp;
+	return cache->free_stack[--cache->free_count];
 }
-
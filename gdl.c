@@ -1,52 +1,32 @@
 #include <stdlib.h>
-#include "lru.h"
+#include "gdl.h"
 #include "cache.h"
 
-// Add a cache entry index to the global dirty list (GDL)
+// Link a cache entry in at the head of the global dirty list (GDL)
 // The GDL tracks all dirty blocks regardless of inode or block type
-// Returns pointer to the new GDL node
-GDL *gdl_push(cache *cache, int index)
+void gdl_push(cache *cache, uint32_t index)
 {
-	GDL *list = cache->gdl;
-	// Allocate new node
-	GDL *node = (GDL*)malloc(sizeof(GDL));
-	node->index = index;
+	GDL_Link *links = cache->gdl_links;
 	
-	if (cache->gdl_size>0)
-	{
-		// Insert into existing circular doubly-linked list
-		node->next = list;
-		node->prev = list->prev;
-		list->prev = node;
-		if (node->prev) node->prev->next = node;
-	}
-	else
-	{
-		// First node - no circular links yet
-		node->next = NULL;
-		node->prev = NULL;
-	}
+	links[index].next = cache->gdl;
+	links[index].prev = CACHE_NIL;
+	if (cache->gdl != CACHE_NIL) links[cache->gdl].prev = index;
+	cache->gdl = index;
 	
 	cache->gdl_size++;
-	return node;
 }
 
-// Remove a specific node from the global dirty list (GDL)
-// Securely wipes the removed node before freeing
-void gdl_pop(cache *cache, GDL *list)
+// Unlink a specific cache entry from the global dirty list (GDL)
+void gdl_pop(cache *cache, uint32_t index)
 {
-	int index = index = list->index;
+	GDL_Link *links = cache->gdl_links;
 	
-	GDL *temp = list;
-	// Update neighboring nodes to bypass this node
-	if (list->prev) list->prev->next = list->next;
-	if (list->next) list->next->prev = list->prev;
-	cache->gdl = list->next;
-	
-	// Securely overwrite node data before freeing
-	arc4random_buf(temp, sizeof(struct GDL));
-	free(temp);
+	// Update neighboring entries to bypass this one
+	if (links[index].prev != CACHE_NIL) links[links[index].prev].next = links[index].next;
+	if (links[index].next != CACHE_NIL) links[links[index].next].prev = links[index].prev;
+	if (cache->gdl == index) cache->gdl = links[index].next;
 	
+	links[index].next = CACHE_NIL;
+	links[index].prev = CACHE_NIL;
 	cache->gdl_size--;
 }
-
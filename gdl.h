@@ -1,11 +1,15 @@
 #ifndef GDL_H
 #define GDL_H
+#include <stdint.h>
 
-typedef struct GDL
+/**
+ * Global dirty list links of one cache entry, stored in an array parallel
+ * to the entries. The list is not circular; CACHE_NIL ends it both ways
+ */
+typedef struct GDL_Link
 {
-	int64_t index;
-	struct GDL *next;
-	struct GDL *prev;
-} GDL;
+	uint32_t next;
+	uint32_t prev;
+} GDL_Link;
 
 #endif
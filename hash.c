@@ -1,19 +1,164 @@
+#include <string.h>
 #include "hash.h"
 
 /**
- * FNV-1a hash function implementation for filesystem path hashing
- * Provides good distribution and is fast for string hashing
- * Used for efficient path lookups in directory structures
+ * Word-at-a-time hashing in the style of wyhash
+ * Input is consumed as 64-bit words folded together with 64x64->128 bit
+ * multiplies. Long inputs run three independent lanes of 16 bytes, which
+ * keeps several multiplies in flight at once.
+ */
+
+static const uint64_t hash_secret[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline uint64_t hash_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Multiply and fold the 128-bit product back into 64 bits
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// Hash bytes into a seed that is already well mixed
+static inline uint64_t hash_fold(const unsigned char *p, size_t len, uint64_t seed) {
+    uint64_t a, b;
+    
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two overlapping reads from each end cover every byte
+            a = (hash_read32(p) << 32) | hash_read32(p + ((len >> 3) << 2));
+            b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t lane1 = seed, lane2 = seed;
+            do {
+                seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+                lane1 = hash_mix(hash_read64(p + 16) ^ hash_secret[2], hash_read64(p + 24) ^ lane1);
+                lane2 = hash_mix(hash_read64(p + 32) ^ hash_secret[3], hash_read64(p + 40) ^ lane2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= lane1 ^ lane2;
+        }
+        while (i > 16) {
+            seed = hash_mix(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // The last 16 bytes, overlapping what was already consumed
+        a = hash_read64(p + i - 16);
+        b = hash_read64(p + i - 8);
+    }
+    
+    __uint128_t r = (__uint128_t)(a ^ hash_secret[1]) * (b ^ seed);
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
+uint64_t hash_bytes_seeded(const void *key, size_t len, uint64_t seed) {
+    seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+    return hash_fold(key, len, seed);
+}
+
+uint64_t hash_bytes(const void *key, size_t len) {
+    return hash_bytes_seeded(key, len, 0);
+}
+
+// Hash of a name of at most 16 bytes from its first and last eight bytes
+static inline uint64_t hash_short(uint64_t first, uint64_t last, size_t len) {
+    return hash_mix(first ^ hash_secret[1], last ^ hash_secret[2] ^ len);
+}
+
+// Hash of a path component on its own
+static inline uint64_t hash_name(const char *name, size_t len) {
+    uint64_t first = 0, last = 0;
+    
+    if (len > 16) return hash_fold((const unsigned char *)name, len, hash_secret[2]);
+    if (len > 8) {
+        first = hash_read64((const unsigned char *)name);
+        last = hash_read64((const unsigned char *)name + len - 8);
+    } else {
+        memcpy(&first, name, len);
+    }
+    return hash_short(first, last, len);
+}
+
+/**
+ * A child's hash combines its parent's hash with a hash of the name alone
+ * The names don't depend on each other, so the hashes of a path's
+ * components can be computed in parallel; only the one multiply that
+ * combines them is chained from component to component
+ */
+uint64_t path_hash_component(uint64_t parent, const char *name, size_t len) {
+    return hash_mix(parent ^ hash_secret[0], hash_name(name, len) ^ hash_secret[3]);
+}
+
+// One bit (the top bit of the byte) set for every '/' byte in a word
+static inline uint64_t hash_slash_mask(uint64_t word) {
+    uint64_t w = word ^ 0x2f2f2f2f2f2f2f2fULL;
+    return ~(((w & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | w | 0x7f7f7f7f7f7f7f7fULL);
+}
+
+/**
+ * path_hash_component for the component [start, end) of a path of len bytes
+ * Short names are read as one masked word where the path has room for it,
+ * rather than copied byte by byte
+ */
+static inline uint64_t path_hash_next(uint64_t hash, const char *path, size_t len, size_t start, size_t end) {
+    size_t n = end - start;
+    if (n > 16 || start + 8 > len) return path_hash_component(hash, path + start, n);
+    
+    uint64_t first = hash_read64((const unsigned char *)path + start);
+    uint64_t last = 0;
+    if (n > 8) last = hash_read64((const unsigned char *)path + end - 8);
+    else first &= ~0ULL >> (64 - 8 * n);
+    return hash_mix(hash ^ hash_secret[0], hash_short(first, last, n) ^ hash_secret[3]);
+}
+
+/**
+ * Fold the components of a path into the root hash, left to right
+ * Separators are found eight bytes at a time
  */
 uint64_t path_hash(const char *path) {
-    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a offset basis (64-bit)
+    uint64_t hash = PATH_HASH_ROOT;
+    size_t len = strlen(path);
+    size_t start = 0;
+    size_t i = 0;
     
-    // Process each character in the path string
-    for (; *path; ++path) {
-        hash ^= (uint64_t)(unsigned char)(*path);  // XOR with current byte
-        hash *= 0x100000001b3ULL; // Multiply by FNV prime (64-bit)
+    for (; i + 8 <= len; i += 8) {
+        uint64_t slashes = hash_slash_mask(hash_read64((const unsigned char *)path + i));
+        while (slashes) {
+            size_t end = i + (__builtin_ctzll(slashes) >> 3);
+            if (end > start) hash = path_hash_next(hash, path, len, start, end);
+            start = end + 1;
+            slashes &= slashes - 1;
+        }
     }
+    for (; i < len; i++) {
+        if (path[i] != '/') continue;
+        if (i > start) hash = path_hash_next(hash, path, len, start, i);
+        start = i + 1;
+    }
+    if (len > start) hash = path_hash_next(hash, path, len, start, len);
     
     return hash;
 }
-
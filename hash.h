@@ -1,17 +1,51 @@
 #ifndef HASH_H
 #define HASH_H
 #include <stdint.h>
+#include <stddef.h>
 
 /**
  * Hash function utilities for filesystem operations
  */
 
 /**
- * Compute FNV-1a hash of a file path string
- * Used for efficient path lookups and directory operations
+ * Hash of the root directory, the starting point of path_hash_component
+ */
+#define PATH_HASH_ROOT 0x2d358dccaa6c78a5ULL
+
+/**
+ * Compute the hash of a file path string
+ * The path is hashed component by component, so the hash of a child is
+ * path_hash_component of its parent's hash; empty components ("//", a
+ * leading or trailing '/') are skipped
  * @param path Null-terminated path string to hash
  * @return 64-bit hash value
  */
 uint64_t path_hash(const char *path);
 
+/**
+ * Extend the hash of a directory path by one component
+ * Resolving a path one component at a time hashes each byte once instead
+ * of rehashing every prefix
+ * @param parent Hash of the directory (PATH_HASH_ROOT for "/")
+ * @param name Component name, without '/'
+ * @param len Length of name
+ * @return Hash of the child path
+ */
+uint64_t path_hash_component(uint64_t parent, const char *name, size_t len);
+
+/**
+ * Compute the hash of a byte string
+ * Reads the input eight bytes at a time (wyhash construction)
+ * @param key Bytes to hash
+ * @param len Number of bytes
+ * @param seed Starting value, to derive independent hashes
+ * @return 64-bit hash value
+ */
+uint64_t hash_bytes_seeded(const void *key, size_t len, uint64_t seed);
+
+/**
+ * Compute the hash of a byte string with the default seed
+ */
+uint64_t hash_bytes(const void *key, size_t len);
+
 #endif
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "l2.h"
+
+// Find the index node for a block, or NULL if the log doesn't hold it
+static L2_LL *l2_lookup(L2Cache *l2, uint64_t block_number)
+{
+	L2_LL *current = l2->HashMap[block_number % L2_HASHMAP_SIZE];
+	while (current)
+	{
+		if (current->block_number==block_number) return current;
+		current = current->next;
+	}
+	return NULL;
+}
+
+// Remove a block from the index and free its slot
+static bool l2_delete(L2Cache *l2, uint64_t block_number)
+{
+	L2_LL *curr = l2->HashMap[block_number % L2_HASHMAP_SIZE];
+	L2_LL *prev = NULL;
+	while (curr && curr->block_number!=block_number)
+	{
+		prev = curr;
+		curr = curr->next;
+	}
+	if (!curr) return false;
+	
+	l2->slot_block[curr->slot] = L2_NO_BLOCK;
+	if (prev) prev->next = curr->next;
+	else l2->HashMap[block_number % L2_HASHMAP_SIZE] = curr->next;
+	free(curr);
+	return true;
+}
+
+L2Cache *l2_open(const char *path, uint64_t slots)
+{
+	if (slots == 0) return NULL;
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) return NULL;
+	if (ftruncate(fd, slots * BLOCK_SIZE) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	
+	L2Cache *l2 = malloc(sizeof(L2Cache));
+	l2->fd = fd;
+	l2->slots = slots;
+	l2->head = 0;
+	l2->slot_block = malloc(slots * sizeof(uint64_t));
+	for (uint64_t i=0; i<slots; i++)
+	{
+		l2->slot_block[i] = L2_NO_BLOCK;
+	}
+	for (int i=0; i<L2_HASHMAP_SIZE; i++)
+	{
+		l2->HashMap[i] = NULL;
+	}
+	memset(&l2->stats, 0, sizeof(l2->stats));
+	return l2;
+}
+
+void l2_put(L2Cache *l2, uint64_t block_number, const void *page)
+{
+	// A clean page that is already in the log doesn't need writing again
+	if (l2_lookup(l2, block_number)) return;
+	
+	// Overwrite the oldest slot, dropping whatever it held
+	uint64_t slot = l2->head;
+	l2->head = (l2->head + 1) % l2->slots;
+	if (l2->slot_block[slot] != L2_NO_BLOCK) l2_delete(l2, l2->slot_block[slot]);
+	
+	if (pwrite(l2->fd, page, BLOCK_SIZE, slot * BLOCK_SIZE) != BLOCK_SIZE) return;
+	
+	L2_LL *node = malloc(sizeof(L2_LL));
+	node->block_number = block_number;
+	node->slot = slot;
+	node->next = l2->HashMap[block_number % L2_HASHMAP_SIZE];
+	l2->HashMap[block_number % L2_HASHMAP_SIZE] = node;
+	l2->slot_block[slot] = block_number;
+	l2->stats.writes++;
+}
+
+bool l2_get(L2Cache *l2, uint64_t block_number, void *page)
+{
+	L2_LL *node = l2_lookup(l2, block_number);
+	if (node && pread(l2->fd, page, BLOCK_SIZE, node->slot * BLOCK_SIZE) == BLOCK_SIZE)
+	{
+		l2->stats.hits++;
+		return true;
+	}
+	l2->stats.misses++;
+	return false;
+}
+
+void l2_invalidate(L2Cache *l2, uint64_t block_number)
+{
+	if (l2_delete(l2, block_number)) l2->stats.invalidations++;
+}
+
+void l2_close(L2Cache *l2)
+{
+	for (int i=0; i<L2_HASHMAP_SIZE; i++)
+	{
+		L2_LL *prev;
+		while (l2->HashMap[i])
+		{
+			prev = l2->HashMap[i];
+			l2->HashMap[i] = l2->HashMap[i]->next;
+			free(prev);
+		}
+	}
+	close(l2->fd);
+	free(l2->slot_block);
+	free(l2);
+}
@@ -0,0 +1,69 @@
+#ifndef L2_H
+#define L2_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+/*=== Second-Level (Local File) Cache ===*/
+
+/**
+ * Clean pages evicted from the RAM cache are appended to a circular log
+ * of BLOCK_SIZE slots in a local file, indexed in memory by block number.
+ * Copies stay valid until the block is dirtied again or the log wraps
+ * around onto their slot, so re-evicting a clean page costs no write.
+ */
+
+#define L2_NO_BLOCK UINT64_MAX
+
+typedef struct L2_LL
+{
+	uint64_t block_number;
+	uint64_t slot;               // Slot in the log file holding the block
+	struct L2_LL *next;
+} L2_LL;
+
+typedef struct L2_Stats
+{
+	uint64_t hits;               // Misses served from the log file
+	uint64_t misses;             // Misses that fell through to the disk image
+	uint64_t writes;             // Pages appended to the log
+	uint64_t invalidations;      // Copies dropped because the block was dirtied
+} L2_Stats;
+
+typedef struct L2Cache
+{
+	int fd;                      // Log file descriptor
+	uint64_t slots;              // Number of BLOCK_SIZE slots in the log
+	uint64_t head;               // Next slot to overwrite
+	uint64_t *slot_block;        // Block held by each slot (L2_NO_BLOCK if free)
+	L2_LL *HashMap[L2_HASHMAP_SIZE];
+	L2_Stats stats;
+} L2Cache;
+
+/**
+ * Create a log file of the given number of slots
+ * @param path Path of the log file (truncated if it exists)
+ * @param slots Number of BLOCK_SIZE slots
+ * @return Pointer to the L2 cache, or NULL if the file can't be created
+ */
+L2Cache *l2_open(const char *path, uint64_t slots);
+
+/**
+ * Append a clean page to the log unless it is already there
+ */
+void l2_put(L2Cache *l2, uint64_t block_number, const void *page);
+
+/**
+ * Read a page from the log
+ * @return true if the page was found, false otherwise
+ */
+bool l2_get(L2Cache *l2, uint64_t block_number, void *page);
+
+/**
+ * Drop the copy of a block whose contents are changing
+ */
+void l2_invalidate(L2Cache *l2, uint64_t block_number);
+
+void l2_close(L2Cache *l2);
+
+#endif
@@ -2,65 +2,71 @@
 #include "lru.h"
 #include "cache.h"
 
-// Add a cache entry index to the head of the LRU (Least Recently Used) list
+// Link a cache entry in at the head of the LRU (Least Recently Used) list
 // The LRU list tracks cache usage order for eviction decisions
-// Returns pointer to the new LRU node
-LRU_List *lru_push(cache *cache, int index)
+void lru_push(cache *cache, uint32_t index)
 {
-	LRU_List *list = cache->lru;
-	// Allocate new node
-	LRU_List *node = (LRU_List*)malloc(sizeof(struct LRU_List));
-	node->index = index;
+	LRU_Link *links = cache->lru_links;
 	
-	if (cache->lru_size>0 && list != NULL)
+	if (cache->lru != CACHE_NIL)
 	{
 		// Insert into existing circular doubly-linked list
-		node->next = list;
-		node->prev = list->prev;
-		list->prev = node;
-		node->prev->next = node;
+		uint32_t head = cache->lru;
+		uint32_t tail = links[head].prev;
+		links[index].next = head;
+		links[index].prev = tail;
+		links[tail].next = index;
+		links[head].prev = index;
 	}
 	else
 	{
-		// First node - create circular links to self
-		node->next = node;
-		node->prev = node;
+		// First entry - create circular links to self
+		links[index].next = index;
+		links[index].prev = index;
 	}
 	
+	cache->lru = index;
 	cache->lru_size++;
-	return node;
 }
 
-// Remove the least recently used entry from the LRU list
-// Returns the cache entry index of the evicted item
-// Securely wipes the removed node before freeing
-int64_t lru_pop(cache *cache, LRU_List *list)
+// Unlink a cache entry from wherever it sits in the LRU list
+void lru_remove(cache *cache, uint32_t index)
 {
-	// Get index of LRU item (tail of circular list)
-	int index = (list->prev) ? (list->prev->index) : (index = list->index);
+	LRU_Link *links = cache->lru_links;
 	
 	if (cache->lru_size>1)
 	{
-		// Remove tail node from circular list
-		LRU_List *temp = list->prev;
-		
-		list->prev = list->prev->prev;
-		list->prev->next = list;
-		
-		// Securely overwrite node data before freeing
-		arc4random_buf(temp, sizeof(struct LRU_List));
-		free(temp);
+		uint32_t next = links[index].next;
+		uint32_t prev = links[index].prev;
+		links[prev].next = next;
+		links[next].prev = prev;
+		if (cache->lru == index) cache->lru = next;
 	}
 	else
 	{
-		// Last node in list
-		cache->lru = NULL;
-		arc4random_buf(list, sizeof(struct LRU_List));
-		free(list);
+		// Last entry in list
+		cache->lru = CACHE_NIL;
 	}
 	
+	links[index].next = CACHE_NIL;
+	links[index].prev = CACHE_NIL;
 	cache->lru_size--;
-	
+}
+
+// Remove the least recently used entry from the LRU list
+// Returns the cache entry index of the evicted item
+uint32_t lru_pop(cache *cache)
+{
+	// Tail of the circular list is the least recently used entry
+	uint32_t index = cache->lru_links[cache->lru].prev;
+	lru_remove(cache, index);
 	return index;
 }
 
+// Move a cache entry to the most recently used position
+void lru_touch(cache *cache, uint32_t index)
+{
+	if (cache->lru == index) return;
+	lru_remove(cache, index);
+	lru_push(cache, index);
+}
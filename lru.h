@@ -1,11 +1,20 @@
 #ifndef LRU_H
 #define LRU_H
+#include <stdint.h>
 
-typedef struct LRU_List
+/**
+ * Index used as the null link in the entry-indexed lists
+ */
+#define CACHE_NIL UINT32_MAX
+
+/**
+ * LRU links of one cache entry, stored in an array parallel to the entries
+ * The list is circular; the head is the most recently used entry
+ */
+typedef struct LRU_Link
 {
-	int64_t index;
-	struct LRU_List *next;
-	struct LRU_List *prev;
-} LRU_List;
+	uint32_t next;
+	uint32_t prev;
+} LRU_Link;
 
 #endif
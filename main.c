@@ -8,13 +8,17 @@ int main()
 {
 	DiskInterface* disk = disk_open("my.img");
 	
-	cache *cache = alloc_cache();
+	cache *cache = alloc_cache(SANITIZE_OFF);
+	cache_enable_admission(cache);
+	cache_enable_ztier(cache, 16 * 1024 * 1024);
+	cache_enable_l2(cache, "my.img.l2", 4096);
+	cache_warm(disk, cache, "my.img.warm");
 	
 	alloc_page(disk, cache);  // Reserve block 0
 	BTreeNode *root = btree_node_create(disk, cache, false); 
 	
 	while (true) {
-		printf("Select:\n(1) to insert a key\n(2) to search for a key\n(3) for debug print\n(4) to delete a key\n(5) to simulate sync\n> ");
+		printf("Select:\n(1) to insert a key\n(2) to search for a key\n(3) for debug print\n(4) to delete a key\n(5) to simulate sync\n(6) to print cache stats\n> ");
 		int choice, key, value;
 		scanf("%d", &choice);
 		switch (choice) {
@@ -41,6 +45,9 @@ int main()
 			case 5:
 				cache_sync(disk, cache);
 				break;
+			case 6:
+				cache_print_stats(cache);
+				break;
 			default:
 				free_cache(cache);
 				disk_close(disk);
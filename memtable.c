@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include "memtable.h"
+
+MemTable *memtable_create(uint32_t entries)
+{
+	MemTable *memtable = malloc(sizeof(MemTable));
+	memtable->size = entries ? entries : 1;
+	memtable->entries = malloc(memtable->size * sizeof(MemTable_Entry));
+	memtable->seed = 0x9e3779b97f4a7c15ULL;
+	memtable_clear(memtable);
+	return memtable;
+}
+
+// Pick the level of a new entry: each level up is taken with probability 1/4
+static uint8_t memtable_random_level(MemTable *memtable)
+{
+	// xorshift64
+	memtable->seed ^= memtable->seed << 13;
+	memtable->seed ^= memtable->seed >> 7;
+	memtable->seed ^= memtable->seed << 17;
+	
+	uint64_t bits = memtable->seed;
+	uint8_t level = 1;
+	while (level < MEMTABLE_MAX_LEVEL && (bits & 3) == 0) {
+		level++;
+		bits >>= 2;
+	}
+	return level;
+}
+
+/**
+ * Find the last entry before key on every level
+ * @param prev Filled with the link to update on each level (the head or an entry's next)
+ * @return Entry holding key, or MEMTABLE_NIL
+ */
+static uint32_t memtable_find(MemTable *memtable, uint64_t key, uint32_t **prev)
+{
+	uint32_t *link = NULL;
+	uint32_t index = MEMTABLE_NIL;
+	
+	for (int l = memtable->level - 1; l >= 0; l--) {
+		link = (index == MEMTABLE_NIL) ? &memtable->head[l] : &memtable->entries[index].next[l];
+		while (*link != MEMTABLE_NIL && memtable->entries[*link].key < key) {
+			index = *link;
+			link = &memtable->entries[index].next[l];
+		}
+		if (prev) prev[l] = link;
+	}
+	
+	if (link == NULL || *link == MEMTABLE_NIL || memtable->entries[*link].key != key) return MEMTABLE_NIL;
+	return *link;
+}
+
+/**
+ * Find the entry for a key, linking in a new one if the table doesn't have it
+ * @param added Set to whether the entry is new
+ * @return Entry for key, or MEMTABLE_NIL if the key is new and the table is full
+ */
+static uint32_t memtable_add(MemTable *memtable, uint64_t key, bool *added)
+{
+	uint32_t *prev[MEMTABLE_MAX_LEVEL];
+	uint32_t index = memtable_find(memtable, key, prev);
+	
+	*added = (index == MEMTABLE_NIL);
+	if (index == MEMTABLE_NIL) {
+		if (memtable_full(memtable)) return MEMTABLE_NIL;
+		
+		index = memtable->used++;
+		MemTable_Entry *entry = &memtable->entries[index];
+		entry->key = key;
+		entry->level = memtable_random_level(memtable);
+	
+		// New levels start at the head
+		while (memtable->level < entry->level) {
+			prev[memtable->level] = &memtable->head[memtable->level];
+			memtable->level++;
+		}
+		for (int l = 0; l < entry->level; l++) {
+			entry->next[l] = *prev[l];
+			*prev[l] = index;
+		}
+	}
+	return index;
+}
+
+int memtable_put(MemTable *memtable, uint64_t key, uint64_t value, bool deleted)
+{
+	bool added;
+	uint32_t index = memtable_add(memtable, key, &added);
+	if (index == MEMTABLE_NIL) return -1;
+	
+	memtable->entries[index].value = deleted ? 0 : value;
+	memtable->entries[index].deleted = deleted;
+	memtable->entries[index].if_absent = false;
+	return 0;
+}
+
+int memtable_insert(MemTable *memtable, uint64_t key, uint64_t value)
+{
+	bool added;
+	uint32_t index = memtable_add(memtable, key, &added);
+	if (index == MEMTABLE_NIL) return -1;
+	
+	MemTable_Entry *entry = &memtable->entries[index];
+	if (!added && !entry->deleted) return 1;
+	
+	// Only a key the table knew nothing about may still be below it
+	entry->value = value;
+	entry->deleted = false;
+	entry->if_absent = added;
+	return 0;
+}
+
+int memtable_get(MemTable *memtable, uint64_t key, uint64_t *value)
+{
+	uint32_t index = memtable_find(memtable, key, NULL);
+	if (index == MEMTABLE_NIL) return -1;
+	
+	MemTable_Entry *entry = &memtable->entries[index];
+	if (entry->deleted) return 0;
+	*value = entry->value;
+	return entry->if_absent ? 2 : 1;
+}
+
+bool memtable_full(MemTable *memtable)
+{
+	return memtable->used == memtable->size;
+}
+
+void memtable_clear(MemTable *memtable)
+{
+	memtable->used = 0;
+	memtable->level = 0;
+	for (int l = 0; l < MEMTABLE_MAX_LEVEL; l++) memtable->head[l] = MEMTABLE_NIL;
+}
+
+void memtable_free(MemTable *memtable)
+{
+	if (!memtable) return;
+	free(memtable->entries);
+	free(memtable);
+}
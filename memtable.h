@@ -0,0 +1,83 @@
+#ifndef MEMTABLE_H
+#define MEMTABLE_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/*=== In-memory write buffer (sorted key -> value) ===*/
+
+#define MEMTABLE_MAX_LEVEL 12    // Skiplist levels (enough for 4^12 entries)
+#define MEMTABLE_NIL UINT32_MAX  // Ends a level's list
+
+/**
+ * One buffered write
+ * A deleted entry is a tombstone: it hides the key until it is flushed.
+ * An if_absent entry only takes effect if the store below doesn't hold the key.
+ */
+typedef struct MemTable_Entry
+{
+	uint64_t key;
+	uint64_t value;
+	bool deleted;                // Tombstone for a deleted key
+	bool if_absent;              // Insert that yields to a key already below the table
+	uint8_t level;               // Number of levels the entry is linked into
+	uint32_t next[MEMTABLE_MAX_LEVEL]; // Next entry on each level
+} MemTable_Entry;
+
+/**
+ * Skiplist over a fixed array of entries
+ * Entries are only appended, so the table is emptied as a whole once it
+ * has been written out. Walk it in key order from head[0] along next[0].
+ */
+typedef struct MemTable
+{
+	uint32_t size;               // Number of entries
+	uint32_t used;               // Entries in use
+	uint8_t level;               // Highest level in use
+	uint64_t seed;               // State of the level generator
+	uint32_t head[MEMTABLE_MAX_LEVEL]; // First entry on each level
+	MemTable_Entry *entries;
+} MemTable;
+
+/**
+ * Create an empty table of at most entries keys
+ * @return Pointer to newly allocated table
+ */
+MemTable *memtable_create(uint32_t entries);
+
+/**
+ * Set the value of a key, or replace it with a tombstone
+ * @param deleted Record that the key was deleted (value is ignored)
+ * @return 0 on success, -1 if the key is new and the table is full
+ */
+int memtable_put(MemTable *memtable, uint64_t key, uint64_t value, bool deleted);
+
+/**
+ * Record an insert that only takes effect if the store below doesn't hold the key
+ * A key with a tombstone is known to be absent and simply gets the value.
+ * @return 0 on success, 1 if the table already holds the key (nothing
+ *         changes), -1 if the key is new and the table is full
+ */
+int memtable_insert(MemTable *memtable, uint64_t key, uint64_t value);
+
+/**
+ * Look up a key
+ * @param value Filled with the value if the key is present or only inserted if absent
+ * @return 1 if the key is present, 2 if its value only applies when the
+ *         store below doesn't hold it, 0 if it has a tombstone, -1 if the
+ *         table doesn't know it
+ */
+int memtable_get(MemTable *memtable, uint64_t key, uint64_t *value);
+
+/**
+ * Whether a put of a new key would fail
+ */
+bool memtable_full(MemTable *memtable);
+
+/**
+ * Drop every entry
+ */
+void memtable_clear(MemTable *memtable);
+
+void memtable_free(MemTable *memtable);
+
+#endif
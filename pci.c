@@ -41,12 +41,21 @@ void pci_insert(PCI_HM *hashmap, uint64_t block_number, uint64_t index)
 	hashmap->HashMap[block_number % HASHMAP_SIZE] = node;
 }
 
+// Release a node removed from the index once no lookup can be walking it
+static void pci_node_free(void *ptr, void *ctx)
+{
+	(void)ctx;
+	free(ptr);
+}
+
 // Remove a block number from the primary cache index (PCI)
 // Called when a block is evicted from the cache
+// With epoch reclamation enabled the node is retired instead of freed, so a
+// concurrent pci_lookup that already reached it can still follow its next link
 void pci_delete(PCI_HM *hashmap, uint64_t block_number)
 {
 	PCI_LL *curr = hashmap->HashMap[block_number % HASHMAP_SIZE];
-	PCI_LL *prev;
+	PCI_LL *prev = NULL;
 	
 	// Find the node to delete
 	while (curr!=NULL)
@@ -68,5 +77,6 @@ void pci_delete(PCI_HM *hashmap, uint64_t block_number)
 		// Deleting head of chain
 		hashmap->HashMap[block_number % HASHMAP_SIZE] = curr->next;
 	}
-	free(curr);
+	if (hashmap->ebr) ebr_retire(hashmap->ebr, hashmap->ebr_tid, curr, pci_node_free, NULL);
+	else free(curr);
 }
@@ -1,6 +1,7 @@
 #ifndef PCI_H
 #define PCI_H
 #include "config.h"
+#include "ebr.h"
 
 /*=== Primary Cache Index HashMap ===*/
 
@@ -15,6 +16,8 @@ typedef struct PCI_LL
 typedef struct PCI_HM
 {
 	struct PCI_LL *HashMap[HASHMAP_SIZE];
+	EBR *ebr;                    // Defers freeing removed nodes past open critical sections (NULL frees at once)
+	int ebr_tid;                 // Thread slot of the cache owner in ebr
 } PCI_HM;
 
 int pci_lookup(PCI_HM *hashmap, uint64_t block_number);
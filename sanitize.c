@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include <bsd/stdlib.h>
+#include "sanitize.h"
+
+// Clear a buffer before it is freed according to the cache's policy
+// Metadata nodes only hold indices and block numbers, so zeroing is the strongest policy offered
+void sanitize(sanitize_policy_t policy, void *ptr, size_t len)
+{
+	if (policy==SANITIZE_ZERO) explicit_bzero(ptr, len);
+}
+
+// Overwrite a buffer with random bytes before it is freed
+// Only used for page data belonging to inodes marked sensitive
+void sanitize_random(void *ptr, size_t len)
+{
+	arc4random_buf(ptr, len);
+}
+
+// Check whether an inode has been marked sensitive
+bool si_lookup(SI_HM *hashmap, uint64_t inode_number)
+{
+	SI_LL *current = hashmap->HashMap[inode_number % HASHMAP_SIZE];
+	
+	// Walk the chain looking for matching inode
+	while (current)
+	{
+		if (current->inode_number==inode_number) return true;
+		current = current->next;
+	}
+	
+	return false;
+}
+
+// Mark an inode sensitive so its cached pages are randomized when freed
+void si_insert(SI_HM *hashmap, uint64_t inode_number)
+{
+	if (si_lookup(hashmap, inode_number)) return;
+	
+	// Create new node
+	SI_LL *node = malloc(sizeof(SI_LL));
+	node->inode_number = inode_number;
+	
+	// Insert at head of hash bucket chain
+	node->next = hashmap->HashMap[inode_number % HASHMAP_SIZE];
+	hashmap->HashMap[inode_number % HASHMAP_SIZE] = node;
+}
+
+// Free every node in the sensitive inode set
+void si_clear(SI_HM *hashmap)
+{
+	for (int i=0; i<HASHMAP_SIZE; i++)
+	{
+		SI_LL *prev;
+		while (hashmap->HashMap[i])
+		{
+			prev = hashmap->HashMap[i];
+			hashmap->HashMap[i] = hashmap->HashMap[i]->next;
+			free(prev);
+		}
+	}
+}
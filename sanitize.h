@@ -0,0 +1,50 @@
+#ifndef SANITIZE_H
+#define SANITIZE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "config.h"
+
+/**
+ * Memory sanitization applied to cache memory before it is freed
+ * The policy is chosen once when the cache is created
+ */
+typedef enum {
+	SANITIZE_OFF,             // Release memory without clearing it
+	SANITIZE_ZERO,            // Clear memory with explicit_bzero before release
+} sanitize_policy_t;
+
+/*=== Sensitive Inode Set ===*/
+
+typedef struct SI_LL
+{
+	uint64_t inode_number;
+	struct SI_LL *next;
+} SI_LL;
+
+typedef struct SI_HM
+{
+	struct SI_LL *HashMap[HASHMAP_SIZE];
+} SI_HM;
+
+/**
+ * Clear a buffer according to the sanitization policy
+ * @param policy Sanitization policy of the owning cache
+ * @param ptr Buffer about to be freed
+ * @param len Size of the buffer in bytes
+ */
+void sanitize(sanitize_policy_t policy, void *ptr, size_t len);
+
+/**
+ * Overwrite a buffer with random bytes
+ * Reserved for page data of sensitive inodes
+ * @param ptr Buffer about to be freed
+ * @param len Size of the buffer in bytes
+ */
+void sanitize_random(void *ptr, size_t len);
+
+bool si_lookup(SI_HM *hashmap, uint64_t inode_number);
+void si_insert(SI_HM *hashmap, uint64_t inode_number);
+void si_clear(SI_HM *hashmap);
+
+#endif
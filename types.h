@@ -2,10 +2,15 @@
 #define TYPES_H
 
 #include "pci.h"
-#include "fl.h"
 #include "lru.h"
 #include "dl.h"
 #include "gdl.h"
+#include "sanitize.h"
+#include "cms.h"
+#include "zt.h"
+#include "l2.h"
+#include "ebr.h"
+#include "aio.h"
 
 // ==================== DISK INTERFACE ====================
 
@@ -23,18 +28,84 @@ typedef struct DiskInterface {
 // =================== Cache Structures ===================
 
 /**
- * Represents a single cache entry containing a disk block
+ * Hot fields of a single cache entry
+ * Cache entries are stored as parallel arrays indexed by entry number:
+ * these fields are read on every lookup, eviction and sync, so they are
+ * packed into 16 bytes (four entries per cache line) and kept apart from
+ * the list links, owning inode and page pointer
  */
-typedef struct cache_entry_t
+typedef struct cache_meta_t
 {
-	bool dirty_bit;              // True if block has been modified and needs writeback
-	int pin_count;               // Reference count for preventing eviction
 	uint64_t block_number;       // Disk block number this entry represents
-	uint64_t inode_number;       // Inode that owns this block (for data blocks)
-	void *page_data;             // Pointer to the actual cached block data
-	struct LRU_List *lru_pos;    // Position in LRU list for eviction policy
-	struct GDL *gdl_pos;         // Position in global dirty list
-} cache_entry_t;
+	uint16_t dirty_start;        // First modified byte within the page (valid while dirty)
+	uint16_t dirty_end;          // One past the last modified byte within the page
+	uint16_t pin_count;          // Reference count for preventing eviction
+	uint8_t dirty_bit;           // True if block has been modified and needs writeback
+	uint8_t flags;               // CACHE_FLAG_* state bits
+} cache_meta_t;
+
+#define CACHE_FLAG_RESIDENT 0x01 // Entry currently holds a block
+#define CACHE_FLAG_FLUSHING 0x02 // A checkpoint snapshot of the entry is not on disk yet
+
+/**
+ * Block number used to mark the transient buffer as empty
+ */
+#define CACHE_NO_BLOCK UINT64_MAX
+
+/**
+ * Snapshot of a dirty range taken when a checkpoint begins
+ * The checkpoint writes the snapshot, not the live page, so writers can
+ * keep modifying the entry while its old contents are on their way to disk
+ */
+typedef struct cache_shadow_t
+{
+	uint64_t block_number;       // Disk block the snapshot belongs to
+	uint32_t index;              // Cache entry the snapshot was taken from
+	uint16_t offset;             // First byte of the snapshot within the block
+	uint16_t len;                // Number of bytes in the snapshot
+	void *data;                  // Snapshot bytes (NULL once written)
+} cache_shadow_t;
+
+/**
+ * Callback run when a block requested with get_block_async is available
+ * The page may be read or modified in place (followed by cache_mark_dirty)
+ * until the callback returns
+ */
+typedef void (*cache_callback_t)(void *page, void *ctx);
+
+typedef struct CACHE_Waiter
+{
+	cache_callback_t fn;
+	void *ctx;
+	struct CACHE_Waiter *next;
+} CACHE_Waiter;
+
+/**
+ * An asynchronous miss in flight
+ * Later requests for the same block wait on it instead of issuing a read
+ */
+typedef struct CACHE_Pending
+{
+	uint64_t inum;               // Inode that owns the block
+	bool stale;                  // Block was installed during the read, so the data read may be old
+	AIO_Request req;             // Read of the block into a staging buffer
+	CACHE_Waiter *waiters;       // Callbacks to run, in request order
+	CACHE_Waiter *waiters_tail;
+	struct CACHE_Pending *next;
+} CACHE_Pending;
+
+/**
+ * Running counters for cache behaviour
+ */
+typedef struct cache_stats_t
+{
+	uint64_t hits;               // Lookups served from a cache entry
+	uint64_t misses;             // Lookups that had to go below the cache
+	uint64_t evictions;          // Entries evicted to make room
+	uint64_t writebacks;         // Dirty entries written back on eviction
+	uint64_t rejected;           // Misses the admission filter kept out of the cache
+	uint64_t coalesced;          // Asynchronous misses that joined a read already in flight
+} cache_stats_t;
 
 /**
  * Main cache structure managing all cached disk blocks
@@ -44,12 +115,36 @@ typedef struct cache
 	int cache_size;              // Total number of cache entries
 	int lru_size;                // Current size of LRU list
 	int gdl_size;                // Current size of global dirty list
-	cache_entry_t *cache;        // Array of cache entries
+	int free_count;              // Number of unused entries on the free stack
+	cache_meta_t *meta;          // Hot fields of every entry
+	LRU_Link *lru_links;         // LRU list links of every entry
+	GDL_Link *gdl_links;         // Global dirty list links of every entry
+	uint64_t *inode_number;      // Inode that owns each entry's block (for data blocks)
+	void **page_data;            // Cached block data of every entry
+	uint32_t *free_stack;        // Indices of unused entries
 	PCI_HM *pci;                 // Primary Cache Index: maps block_number -> cache_index
-	LRU_List *lru;               // LRU list head for eviction policy
-	FL_LL *free_list;            // Free list of available cache slots
+	uint32_t lru;                // LRU list head (most recently used entry, CACHE_NIL if empty)
 	DL_HM *dirty_list;           // Dirty list: maps inode_number -> dirty blocks
-	GDL *gdl;                    // Global dirty list for sync operations
+	uint32_t gdl;                // Global dirty list head (CACHE_NIL if empty)
+	sanitize_policy_t sanitize;  // How freed cache memory is cleared
+	SI_HM *sensitive;            // Inodes whose pages are randomized when freed
+	char *warm_path;             // Sidecar file the hot set is saved to on shutdown (NULL if disabled)
+	CMS *sketch;                 // TinyLFU frequency filter (NULL if admission is disabled)
+	void *transient;             // Buffer serving misses the admission filter rejected
+	uint64_t transient_block;    // Block held in the transient buffer (CACHE_NO_BLOCK if empty)
+	uint64_t transient_inum;     // Inode that owns the block in the transient buffer
+	ZTier *ztier;                // Compressed tier for evicted pages (NULL if disabled)
+	L2Cache *l2;                 // Local file victim cache (NULL if disabled)
+	cache_shadow_t *checkpoint;  // Snapshots of the checkpoint in progress (NULL if none)
+	int checkpoint_count;        // Number of snapshots taken by the checkpoint
+	int checkpoint_next;         // Next snapshot the checkpoint will write
+	uint32_t *shadow_slot;       // Position of each flushing entry's snapshot in checkpoint
+	EBR *ebr;                    // Epoch reclamation for evicted pages and freed nodes (NULL if disabled)
+	int ebr_tid;                 // Thread slot of the cache owner in ebr
+	AIO *aio;                    // Worker pool for get_block_async (NULL if disabled)
+	CACHE_Pending *pending[HASHMAP_SIZE]; // Asynchronous misses in flight by block number
+	int pending_count;           // Number of asynchronous misses in flight
+	cache_stats_t stats;         // Hit, miss and eviction counters
 } cache;
 
 #endif
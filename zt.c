@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include "zt.h"
+
+/**
+ * Header stored in front of every blob in the slab
+ */
+typedef struct ZT_Header
+{
+	uint64_t block_number;
+	uint32_t length;             // Compressed length of the blob that follows
+	uint32_t live;               // Cleared once the blob is read back or invalidated
+} ZT_Header;
+
+#define ZT_MIN_RUN 3             // Shortest repeat worth a run token
+#define ZT_MAX_RUN (0x7f + ZT_MIN_RUN)
+#define ZT_MAX_LITERALS 0x80
+
+// Bytes a blob of the given compressed length occupies in the slab
+static uint64_t zt_space(uint32_t length)
+{
+	return (sizeof(ZT_Header) + length + 7) & ~7ULL;
+}
+
+// Compress a block with a byte-oriented run-length code
+// Control bytes below 0x80 introduce c+1 literal bytes; 0x80 and above
+// repeat the following byte (c & 0x7f)+3 times. Mostly-zero B-tree and
+// bitmap pages collapse to a few dozen bytes.
+// Returns the compressed length, or 0 if it would exceed cap
+static uint32_t zt_compress(const uint8_t *src, uint8_t *dst, uint32_t cap)
+{
+	uint32_t out = 0, i = 0, lit = 0;
+	while (i < BLOCK_SIZE)
+	{
+		// Measure the run starting here
+		uint32_t run = 1;
+		while (i + run < BLOCK_SIZE && run < ZT_MAX_RUN && src[i + run] == src[i]) run++;
+		
+		if (run >= ZT_MIN_RUN || lit == ZT_MAX_LITERALS)
+		{
+			// Flush pending literals before the run (or when the literal run is full)
+			if (lit)
+			{
+				if (out + 1 + lit > cap) return 0;
+				dst[out++] = lit - 1;
+				memcpy(dst + out, src + i - lit, lit);
+				out += lit;
+				lit = 0;
+			}
+			if (run >= ZT_MIN_RUN)
+			{
+				if (out + 2 > cap) return 0;
+				dst[out++] = 0x80 | (run - ZT_MIN_RUN);
+				dst[out++] = src[i];
+				i += run;
+				continue;
+			}
+		}
+		lit++;
+		i++;
+	}
+	if (lit)
+	{
+		if (out + 1 + lit > cap) return 0;
+		dst[out++] = lit - 1;
+		memcpy(dst + out, src + i - lit, lit);
+		out += lit;
+	}
+	return out;
+}
+
+// Expand a blob produced by zt_compress back into a full block
+static bool zt_decompress(const uint8_t *src, uint32_t length, uint8_t *dst)
+{
+	uint32_t in = 0, out = 0;
+	while (in < length)
+	{
+		uint8_t c = src[in++];
+		if (c & 0x80)
+		{
+			uint32_t run = (c & 0x7f) + ZT_MIN_RUN;
+			if (out + run > BLOCK_SIZE || in >= length) return false;
+			memset(dst + out, src[in++], run);
+			out += run;
+		}
+		else
+		{
+			uint32_t lit = c + 1;
+			if (out + lit > BLOCK_SIZE || in + lit > length) return false;
+			memcpy(dst + out, src + in, lit);
+			in += lit;
+			out += lit;
+		}
+	}
+	return out == BLOCK_SIZE;
+}
+
+// Find the index node for a block, or NULL if the tier doesn't hold it
+static ZT_LL *zt_lookup(ZTier *zt, uint64_t block_number)
+{
+	ZT_LL *current = zt->HashMap[block_number % ZT_HASHMAP_SIZE];
+	while (current)
+	{
+		if (current->block_number==block_number) return current;
+		current = current->next;
+	}
+	return NULL;
+}
+
+// Remove a block from the index and mark its blob dead
+// The blob's space is reclaimed when the tail passes over it
+static void zt_delete(ZTier *zt, uint64_t block_number)
+{
+	ZT_LL *curr = zt->HashMap[block_number % ZT_HASHMAP_SIZE];
+	ZT_LL *prev = NULL;
+	while (curr && curr->block_number!=block_number)
+	{
+		prev = curr;
+		curr = curr->next;
+	}
+	if (!curr) return;
+	
+	((ZT_Header*)(zt->slab + curr->offset))->live = 0;
+	if (prev) prev->next = curr->next;
+	else zt->HashMap[block_number % ZT_HASHMAP_SIZE] = curr->next;
+	free(curr);
+}
+
+// Drop the oldest blob in the slab to free its space
+static void zt_reclaim(ZTier *zt)
+{
+	ZT_Header *header = (ZT_Header*)(zt->slab + zt->tail);
+	if (header->live) zt_delete(zt, header->block_number);
+	
+	uint64_t space = zt_space(header->length);
+	zt->tail += space;
+	zt->used -= space;
+	if (zt->wrapped && zt->tail == zt->wrap)
+	{
+		// Reached the end of the data before the wrap - continue from the start
+		zt->tail = 0;
+		zt->wrapped = false;
+	}
+}
+
+ZTier *zt_create(uint64_t bytes)
+{
+	ZTier *zt = malloc(sizeof(ZTier));
+	zt->size = bytes & ~7ULL;
+	zt->slab = malloc(zt->size);
+	zt->head = 0;
+	zt->tail = 0;
+	zt->wrap = 0;
+	zt->wrapped = false;
+	zt->used = 0;
+	for (int i=0; i<ZT_HASHMAP_SIZE; i++)
+	{
+		zt->HashMap[i] = NULL;
+	}
+	memset(&zt->stats, 0, sizeof(zt->stats));
+	return zt;
+}
+
+void zt_put(ZTier *zt, uint64_t block_number, const void *page)
+{
+	uint8_t buf[BLOCK_SIZE];
+	
+	// Any older copy is stale, whether or not the new one gets stored
+	zt_delete(zt, block_number);
+	
+	uint32_t length = zt_compress(page, buf, BLOCK_SIZE * ZT_MAX_RATIO / 8);
+	if (length == 0)
+	{
+		zt->stats.incompressible++;
+		return;
+	}
+	
+	uint64_t need = zt_space(length);
+	if (need > zt->size) return;
+	
+	// Make room at head, reclaiming the oldest blobs as needed
+	for (;;)
+	{
+		if (zt->used == 0)
+		{
+			zt->head = 0;
+			zt->tail = 0;
+			zt->wrapped = false;
+		}
+		if (!zt->wrapped)
+		{
+			// Data lives in [tail, head)
+			if (zt->size - zt->head >= need) break;
+			// Not enough room before the end of the slab - wrap around
+			zt->wrap = zt->head;
+			zt->wrapped = true;
+			zt->head = 0;
+		}
+		// Data lives in [tail, wrap) and [0, head)
+		if (zt->tail - zt->head >= need) break;
+		zt_reclaim(zt);
+	}
+	
+	// Append the blob
+	ZT_Header *header = (ZT_Header*)(zt->slab + zt->head);
+	header->block_number = block_number;
+	header->length = length;
+	header->live = 1;
+	memcpy(header + 1, buf, length);
+	
+	// Index it
+	ZT_LL *node = malloc(sizeof(ZT_LL));
+	node->block_number = block_number;
+	node->offset = zt->head;
+	node->next = zt->HashMap[block_number % ZT_HASHMAP_SIZE];
+	zt->HashMap[block_number % ZT_HASHMAP_SIZE] = node;
+	
+	zt->head += need;
+	zt->used += need;
+	zt->stats.stores++;
+	zt->stats.bytes_in += BLOCK_SIZE;
+	zt->stats.bytes_out += length;
+}
+
+bool zt_get(ZTier *zt, uint64_t block_number, void *page)
+{
+	ZT_LL *node = zt_lookup(zt, block_number);
+	if (!node)
+	{
+		zt->stats.misses++;
+		return false;
+	}
+	
+	ZT_Header *header = (ZT_Header*)(zt->slab + node->offset);
+	bool rv = zt_decompress((uint8_t*)(header + 1), header->length, page);
+	
+	// The page moves back up to the cache, so the tier no longer needs it
+	zt_delete(zt, block_number);
+	if (rv) zt->stats.hits++;
+	else zt->stats.misses++;
+	return rv;
+}
+
+void zt_invalidate(ZTier *zt, uint64_t block_number)
+{
+	zt_delete(zt, block_number);
+}
+
+void zt_free(ZTier *zt)
+{
+	for (int i=0; i<ZT_HASHMAP_SIZE; i++)
+	{
+		ZT_LL *prev;
+		while (zt->HashMap[i])
+		{
+			prev = zt->HashMap[i];
+			zt->HashMap[i] = zt->HashMap[i]->next;
+			free(prev);
+		}
+	}
+	free(zt->slab);
+	free(zt);
+}
@@ -0,0 +1,72 @@
+#ifndef ZT_H
+#define ZT_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+/*=== Compressed Tier ===*/
+
+/**
+ * Clean pages evicted from the cache are compressed into a circular slab.
+ * Misses check the slab before reading the disk. A page leaves the slab
+ * when it is read back (the tiers are exclusive) or when the slab wraps
+ * around onto it.
+ */
+
+typedef struct ZT_LL
+{
+	uint64_t block_number;
+	uint64_t offset;             // Offset of the blob's header in the slab
+	struct ZT_LL *next;
+} ZT_LL;
+
+typedef struct ZT_Stats
+{
+	uint64_t stores;             // Pages compressed into the slab
+	uint64_t hits;               // Misses served from the slab
+	uint64_t misses;             // Misses that fell through to the disk
+	uint64_t incompressible;     // Pages not stored because they didn't shrink enough
+	uint64_t bytes_in;           // Uncompressed bytes of stored pages
+	uint64_t bytes_out;          // Compressed bytes of stored pages
+} ZT_Stats;
+
+typedef struct ZTier
+{
+	uint8_t *slab;               // Circular log of compressed pages
+	uint64_t size;               // Slab size in bytes
+	uint64_t head;               // Where the next blob is appended
+	uint64_t tail;               // Oldest blob still occupying space
+	uint64_t wrap;               // End of the data head wrapped away from
+	bool wrapped;                // True while head is behind tail
+	uint64_t used;               // Bytes between tail and head
+	ZT_LL *HashMap[ZT_HASHMAP_SIZE];
+	ZT_Stats stats;
+} ZTier;
+
+/**
+ * Create a compressed tier with a slab of the given size
+ * @param bytes Slab size in bytes
+ * @return Pointer to newly allocated tier
+ */
+ZTier *zt_create(uint64_t bytes);
+
+/**
+ * Compress a page into the slab, replacing any older copy
+ * Pages that don't compress below ZT_MAX_RATIO of a block are skipped
+ */
+void zt_put(ZTier *zt, uint64_t block_number, const void *page);
+
+/**
+ * Decompress a page out of the slab and drop it from the tier
+ * @return true if the page was found, false otherwise
+ */
+bool zt_get(ZTier *zt, uint64_t block_number, void *page);
+
+/**
+ * Drop a page whose on-disk contents are about to change
+ */
+void zt_invalidate(ZTier *zt, uint64_t block_number);
+
+void zt_free(ZTier *zt);
+
+#endif